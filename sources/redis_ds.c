@@ -1,9 +1,17 @@
 #include "redis_ds.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <hiredis/hiredis.h>
+#include <poll.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #define FREE_REPLY(x)       \
     if (x)                  \
@@ -19,18 +27,311 @@
 #define REDIS_IS_STRING(x) (x && (REDIS_REPLY_STRING == x->type))
 #define REDIS_IS_ARRAY(x) (x && (REDIS_REPLY_ARRAY == x->type))
 
+/**
+ * Command queued for the I/O thread
+ */
+typedef struct redis_request
+{
+    struct redis_request *next;
+    char *command; // formatted RESP
+    int length;
+    int detached; // no caller waits, the reply is discarded
+    int resend;   // a read, resent once after a reconnect
+    int claimed;  // taken by the reply or by the caller giving up at its deadline
+    int count;    // replies of the command, several for a chunk of commands
+    redisReply **replies; // count - 1 slots for the replies before the last one | NULL
+    redisReply *reply;    // the last reply
+    sem_t done;
+} redis_request;
+
+/**
+ * Auto-pipelining I/O thread with the lock-free MPSC queue of requests
+ */
+typedef struct redis_pipeline
+{
+    redis_request *head; // last pushed
+    redis_request *tail; // next to pop
+    redis_request stub;
+    sem_t wakeup;
+    pthread_t thread;
+    int stop;
+} redis_pipeline;
+
+#define REDIS_PIPELINE_BATCH 256
+#define REDIS_DEADLINE_RETRY 2 // milliseconds left to reconnect and retry
+
+#define REDIS_MIGRATE_BATCH 256 // keys per SCAN step and pipeline
+#define REDIS_MIGRATE_TIMEOUT 5000 // MIGRATE timeout in milliseconds
+#define REDIS_MEMORY_BUCKETS 16 // size histogram, powers of two from 64 bytes
+#define REDIS_MEMORY_LARGEST 10 // largest keys of a memory report
+
+/**
+ * Keys of one SCAN step of a source server
+ */
+typedef struct redis_migrate_batch
+{
+    struct redis_migrate_batch *next;
+    int server;
+    int count;
+    char *keys[REDIS_MIGRATE_BATCH];
+    size_t lengths[REDIS_MIGRATE_BATCH];
+} redis_migrate_batch;
+
+/**
+ * Migration shared by the scanner and the workers
+ */
+typedef struct redis_migrate_job
+{
+    struct redis_dataspace *source;
+    int target;   // server index of the pinned target, -1 = servers by the ring
+    int base;
+    char *prefix; // target prefix
+    int rename;   // the prefix changes, MIGRATE can not be used
+    int purge;    // the run deleting the source keys after the switch
+    long long lost; // source keys of the purge whose UNLINK failed
+    long long rate;
+    int64_t slot; // rate limiter: monotonic ms of the next free slot
+    int64_t start;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    redis_migrate_batch *head;
+    redis_migrate_batch *tail;
+    int size;
+    int limit;
+    int closed;
+    redis_migration progress;
+} redis_migrate_job;
+
+/**
+ * Slot of the shared read cache, guarded by the seqlock `seq`.
+ * `data` holds the full key followed by the packed value.
+ */
+typedef struct redis_cache_slot
+{
+    uint32_t seq; // odd while written: writer pid << 1 | 1
+    uint32_t size;
+    uint64_t hash; // 0 = never used
+    int64_t expire; // monotonic milliseconds
+    uint32_t keylen;
+    uint32_t plain; // the value of a bucketed dataspace was read from its own key
+    char data[992];
+} redis_cache_slot;
+
+typedef struct redis_cache_header
+{
+    uint64_t magic;
+    uint64_t reserved[7];
+} redis_cache_header;
+
+typedef struct redis_cache
+{
+    redis_cache_header *header;
+    redis_cache_slot *slots;
+    size_t mask;
+    size_t size;
+} redis_cache;
+
+#define REDIS_CACHE_MAGIC 0x3130534452444552ULL // "REDISDS1"
+#define REDIS_CACHE_PROBE 8
+#define REDIS_BUCKET_SEPARATOR '\x1f' // reserved in the keys of bucketed dataspaces
+
+#define REDIS_HOT_DEPTH 4   // count-min sketch rows
+#define REDIS_HOT_WIDTH 1024 // counters per row
+#define REDIS_HOT_TOP 64     // candidates of the hot keys heap
+
+/**
+ * Count-min sketch of the sampled keys of one thread,
+ * only its thread writes the counters, redisDS_hotKeys() sums them
+ */
+typedef struct redis_hot_sketch
+{
+    struct redis_hot *hot;
+    uint32_t counts[REDIS_HOT_DEPTH][REDIS_HOT_WIDTH];
+    uint64_t random; // xorshift state of the sampling
+    long long skip;  // operations to the next sample
+    struct redis_hot_sketch *next;  // of the dataspace
+    struct redis_hot_sketch *local; // of the thread
+} redis_hot_sketch;
+
+typedef struct redis_hot_key
+{
+    char *key;
+    uint64_t hash;
+    uint64_t count; // estimate of the thread that sampled it last
+} redis_hot_key;
+
+/**
+ * Hot key detection of a dataspace,
+ * the top keys are a min-heap by count
+ */
+typedef struct redis_hot
+{
+    long long sample; // one of sample operations on average, 0 = off
+    pthread_mutex_t mutex;
+    redis_hot_sketch *sketches;
+    redis_hot_key top[REDIS_HOT_TOP];
+    int size;
+} redis_hot;
+
+#define REDIS_RATE_SLOTS 1024 // locally known exhausted limits
+
+/**
+ * Rate limit denied by the server, the key is denied locally until retry
+ */
+typedef struct redis_rate_slot
+{
+    uint64_t hash;  // of the base, key, limit and window
+    int64_t retry; // monotonic milliseconds
+    int64_t reset;
+} redis_rate_slot;
+
+#define REDIS_HEDGE_BINS 32     // log2 microsecond bins of the read latencies
+#define REDIS_HEDGE_RATE 5      // default percent of the reads that may be hedged
+#define REDIS_HEDGE_WINDOW 4096 // reads between the halvings of the statistics
+#define REDIS_HEDGE_WARMUP 64   // latencies needed for the adaptive delay
+#define REDIS_HEDGE_STALE 16    // lagging replies after which the spare is reconnected
+
+/**
+ * Hedged reads of a dataspace: a read without a reply after the delay
+ * is sent again over the spare connection of its link, the first reply wins
+ */
+typedef struct redis_hedge
+{
+    long long delay;  // milliseconds, -1 = p95 of the latencies, 0 = off
+    long long rate;   // percent of the reads that may be hedged
+    long long reads;  // since the last halving
+    long long hedges; // since the last halving
+    uint32_t latency[REDIS_HEDGE_BINS]; // bin i counts reads under 2^(i+1) microseconds
+} redis_hedge;
+
+#define REDIS_SERVER_MAX 64
+#define REDIS_PENDING_MAX 1024 // unread replies of no-reply writes before they are drained
+#define REDIS_SET_CHUNK 128 // keys per round trip of redisDS_setMany()
+#define REDIS_SLIDING_SLOTS 16384   // recently refreshed keys
+#define REDIS_SLIDING_PENDING 65536 // touched keys waiting for the flusher
+#define REDIS_SLIDING_INTERVAL 1000 // default milliseconds between the refreshes of a key
+#define REDIS_SLIDING_FLUSH 100     // milliseconds between the flushes
+
+typedef struct redis_sliding_slot
+{
+    uint64_t hash; // of the base and the key
+    int64_t time;  // monotonic milliseconds of the last refresh
+} redis_sliding_slot;
+
+/**
+ * Touched keys of one server
+ */
+typedef struct redis_sliding_queue
+{
+    char **keys;
+    int count;
+    int size;
+} redis_sliding_queue;
+
+/**
+ * Sliding expiration of a dataspace: the read keys are collected by server
+ * and their TTL is renewed by the flusher thread in pipelines.
+ * The keys are routed by the reading threads, the flusher never reads the ring.
+ */
+typedef struct redis_sliding
+{
+    struct redis_dataspace *dataspace;
+    long long ttl;      // seconds, 0 = off
+    long long interval; // milliseconds
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    pthread_cond_t done;
+    pthread_t thread;
+    int running; // the flusher is started by the first ttl > 0
+    int stop;
+    long long requested; // syncs requested
+    long long flushed;   // syncs done
+    redis_sliding_queue queues[REDIS_SERVER_MAX];
+    int count; // touched keys of all queues
+    redis_sliding_slot sent[REDIS_SLIDING_SLOTS];
+    struct redisContext *contexts[REDIS_SERVER_MAX]; // of the flusher by server
+} redis_sliding;
+#define REDIS_RING_POINTS 160 // ring points per weight unit
+
+/**
+ * Point of the consistent hash ring
+ */
+typedef struct redis_point
+{
+    uint32_t hash;
+    int server;
+} redis_point;
+
+/**
+ * Connection of a dataspace to one of the servers
+ */
+typedef struct redis_link
+{
+    struct redis_dataspace *dataspace;
+    int server;
+    struct redisContext *context;
+    int pending; // replies to drain
+    int armed;   // socket timeouts are set from a deadline
+    redis_pipeline *pipeline;
+    struct redisContext *spare; // second connection of the hedged reads
+    int stale;                  // replies of the spare to skip
+} redis_link;
+
 typedef struct redis_dataspace
 {
     char *name;
     int base;
     char *prefix;
-    struct redisContext *context;
+    redis_link *links[REDIS_SERVER_MAX]; // by server index
+    int noreply; // writes do not wait for replies
+    int failed;  // failed no-reply commands since the last sync
+    long long cache; // shared cache lifetime in milliseconds, 0 = off
+    int approximate; // append counts by HyperLogLog
+    int atomic;      // chunks of redisDS_setMany() inside MULTI/EXEC
+    long long buckets; // scalars are stored in hash buckets, 0 = off
+    int pinned;        // server of a migrated dataspace, -1 = by the ring
+    int purge;         // redisDS_migrate() deletes the source keys
+    redis_hot *hot;    // hot key detection, NULL = never enabled
+    redis_sliding *sliding; // sliding expiration, NULL = never enabled
+    redis_hedge *hedge;     // hedged reads, NULL = never enabled
     struct redis_dataspace *next;
+    struct redis_dataspace *retired; // replaced registrations, freed on close
 } redis_dataspace;
 
+/**
+ * Memory block of a read result arena.
+ * The root node of the result tree is allocated first,
+ * at the beginning of `data` of the first block.
+ */
+typedef struct redis_arena
+{
+    uint64_t magic;           // REDIS_ARENA_MAGIC while the tree is handed out
+    struct redis_arena *next; // overflow blocks
+    struct redis_arena *tail; // block being filled (first block only)
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(16)));
+} redis_arena;
+
+#define REDIS_ARENA_BLOCK 4096
+#define REDIS_ARENA_MAGIC 0x414e455241534452ULL // "RDSARENA"
+#define REDIS_ARENA_ALIGN(x) (((x) + 15) & ~((size_t)15))
+
 //
-static redis_server _redis_server_ = {NULL, 0, NULL, 0};
+static redis_server _redis_servers_[REDIS_SERVER_MAX];
+static int _redis_server_count = 0;
+static redis_point *_redis_ring_ = NULL;
+static size_t _redis_ring_size = 0;
 static redis_dataspace *_redis_ds_list = NULL;
+static redis_dataspace *_redis_ds_retired = NULL;
+static redis_cache _redis_cache_ = {NULL, NULL, 0, 0};
+static unsigned _redis_hot_generation = 1; // bumped when the dataspaces are freed
+static char _redis_rate_sha_[48] = "";
+static pthread_mutex_t _redis_rate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _redis_ds_mutex = PTHREAD_MUTEX_INITIALIZER; // changes of the registrations
+static redis_rate_slot _redis_rate_denied_[REDIS_RATE_SLOTS];
+static const char _redis_arena_tag_[] = ""; // name of the root node of an arena tree
 
 // static pthread_mutex_t redis_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -55,22 +356,91 @@ static redis_dataspace *redisDS_object(char *name, int base, char *prefix);
 static redis_dataspace *redisDS_free(redis_dataspace *dataspace);
 static redis_dataspace *redisDS_object(char *name, int base, char *prefix);
 static redis_dataspace *redisDS_get(char *name);
+static long long redisDS_write(redis_dataspace *dataspace, char *key, cJSON *value, long long ttl, ...);
+
+static int64_t redis_now();
+static long long redis_deadline_left();
+static void redis_deadline_arm(redis_link *link, long long left);
+
+static redis_link *redis_link_create(redis_dataspace *dataspace, int server);
+static redis_link *redis_link_free(redis_link *link);
+static struct redisContext *redis_link_connect(redis_link *link);
+static redis_link *redis_route(redis_dataspace *dataspace, char *key);
+static int redis_server_add(char *host, int port, char *auth, int timeout, int weight);
+static int redis_ring_server(char *key);
+static long long redis_batch_write(redis_dataspace *dataspace, cJSON *object, long long ttl);
+static int redis_ring_build();
+static uint32_t redis_ring_hash(const char *string);
+
+static char *redis_type(redis_link *link, char *key);
+static cJSON *redis_string(redis_link *link, char *key, redis_arena *arena);
+static cJSON *redis_hash(redis_link *link, char *key, redis_arena *arena);
+static cJSON *redis_list(redis_link *link, char *key, redis_arena *arena);
+static cJSON *redis_set(redis_link *link, char *key, redis_arena *arena);
+static cJSON *redis_read(redis_link *link, char *key, redis_arena *arena, long long *pttl);
+static int redis_read_pair(redis_link *link, char **commands, int *lengths, redisReply **replies);
+static cJSON *redis_fetch(redis_dataspace *dataspace, char *key, redis_arena *arena, int *plain);
+static void redis_cache_drop(redis_dataspace *dataspace, char *key);
+static cJSON *redis_bucket_read(redis_dataspace *dataspace, char *key, redis_arena *arena, int *plain, long long *pttl);
+static int redis_bucket_set(redis_dataspace *dataspace, char *key, char *value, long long ttl);
+static long long redis_bucket_increment(redis_dataspace *dataspace, char *key, int value, long long ttl);
+static void redis_hot_sample(redis_dataspace *dataspace, char *key);
+static void redis_hot_free(redis_hot *hot);
+static redis_sliding *redis_sliding_get(redis_dataspace *dataspace);
+static int redis_sliding_start(redis_sliding *sliding);
+static void redis_sliding_touch(redis_dataspace *dataspace, char *key, int plain);
+static void redis_sliding_sync(redis_sliding *sliding);
+static void redis_sliding_free(redis_sliding *sliding);
+static redis_hedge *redis_hedge_get(redis_dataspace *dataspace);
+static char *redis_bucket(redis_dataspace *dataspace, char *key, char **field);
+static struct redisContext *redis_migrate_connect(struct redisContext **contexts, int server, int base);
+static char *redis_scan_pattern(const char *prefix);
+static long long redis_migrate_unlink(redis_migrate_job *job, struct redisContext **sources, redis_migrate_batch *batch, long long *lost);
+static int redis_migrate_run(redis_migrate_job *job, int parallel, redis_migration_progress progress, void *arg);
+static long long redis_ttl(redis_link *link, char *key);
+static long long redis_expire(redis_link *link, char *key, long long expire);
+
+static void redis_reset(redis_link *link);
+static int redis_vappend(redis_link *link, char *format, va_list ap);
+static int redis_append(redis_link *link, char *format, ...);
+static int redis_flush(redis_link *link);
+static int redis_send(redis_link *link, char *key, long long ttl, char *format, ...);
+static int redis_drain(redis_link *link);
+
+static int redis_pipeline_start(redis_link *link);
+static void redis_pipeline_stop(redis_link *link);
+static redisReply *redis_pipeline_command(redis_link *link, char *format, va_list ap);
+static redisReply *redis_pipeline_timed(redis_link *link, char *format, va_list ap, long long left);
+static int redis_pipeline_vsend(redis_link *link, char *format, va_list ap);
+static int redis_pipeline_send(redis_link *link, char *format, ...);
+static int redis_pipeline_formatted(redis_link *link, char *command, int length);
+static int redis_pipeline_chunk(redis_link *link, char *command, int length, int count, redisReply **replies);
+static int redis_request_wait(redis_request *request, long long left);
+static void redis_request_free(redis_request *request);
+static int redis_reply_failed(redisReply *reply);
+static int redis_idempotent(const char *format);
 
-static char *redis_type(redis_dataspace *dataspace, char *key);
-static cJSON *redis_string(redis_dataspace *dataspace, char *key);
-static cJSON *redis_hash(redis_dataspace *dataspace, char *key);
-static void cJSON_AddStringToArray(cJSON *json, const char *string);
-static cJSON *redis_list(redis_dataspace *dataspace, char *key);
-static cJSON *redis_set(redis_dataspace *dataspace, char *key);
-static long long redis_ttl(redis_dataspace *dataspace, char *key);
-static long long redis_expire(redis_dataspace *dataspace, char *key, long long expire);
+static redis_arena *redis_arena_create();
+static void redis_arena_free(redis_arena *arena);
+static void redis_arena_drop();
+static void *redis_arena_alloc(redis_arena *arena, size_t size);
+static cJSON *redis_json_string(redis_arena *arena, const char *string);
+static cJSON *redis_json_number(redis_arena *arena, double number);
+static cJSON *redis_json_container(redis_arena *arena, int type);
+static void redis_json_add(redis_arena *arena, cJSON *json, const char *field, cJSON *item);
 
 static struct redisContext *redis_connect(char *rhost, int rport, char *rauth, int timeout, int base);
 static struct redisContext *redis_disconnect(struct redisContext *redis);
 static int redis_auth(struct redisContext *redis, char *rauth);
 static int redis_select(struct redisContext *redis, int base);
-static redisReply *redis_command(redis_dataspace *dataspace, char *format, ...);
-static redisReply *redis_vcommand(redis_dataspace *dataspace, char *format, va_list ap);
+static redisReply *redis_command(redis_link *link, char *format, ...);
+static redisReply *redis_vcommand(redis_link *link, char *format, va_list ap);
+static redisReply *redis_formatted(redis_link *link, char **commands, int *lengths, int count);
+static int redis_pipelined(redis_link *link, char **commands, int *lengths, int count, redisReply **replies);
+static int redis_pipelined_send(redis_link *link, char **commands, int *lengths, int count);
+static int redis_pipelined_read(redis_link *link, int count, redisReply **replies);
+static redisReply *redis_read_command(redis_link *link, char *format, ...);
+static int64_t redis_lifetime(redis_dataspace *dataspace, long long pttl);
 
 /**
  * Sets server options
@@ -83,19 +453,86 @@ static redisReply *redis_vcommand(redis_dataspace *dataspace, char *format, va_l
  */
 int redisDS_serverOpen(char *host, int port, char *auth, int timeout)
 {
-    if (!_redis_server_.host && !_redis_ds_list)
+    if (!_redis_server_count && !_redis_ds_list)
+    {
+        return redisDS_serverAdd(host, port, auth, timeout, 1);
+    }
+    errno = EINVAL;
+    return 0;
+}
+
+/**
+ * Adds a standalone server to the set.
+ * Keys are distributed over the consistent hash ring of the weighted servers,
+ * adding a server remaps about 1/N of them.
+ * Weight 0 keeps the server out of the ring, as a target of redisDS_migrate().
+ * Must not be called while other threads use the dataspaces.
+ *
+ * @param host
+ * @param port
+ * @param auth
+ * @param timeout
+ * @param weight
+ * @return int
+ */
+int redisDS_serverAdd(char *host, int port, char *auth, int timeout, int weight)
+{
+    if (host && port && ((weight > 0) || (!weight && _redis_server_count)))
+    {
+        return redis_server_add(host, port, auth, timeout, weight) >= 0;
+    }
+    errno = EINVAL;
+    return 0;
+}
+
+/**
+ * Adds the server, weight 0 keeps it out of the ring
+ *
+ * @param host
+ * @param port
+ * @param auth
+ * @param timeout
+ * @param weight
+ * @return int server index | -1
+ */
+static int redis_server_add(char *host, int port, char *auth, int timeout, int weight)
+{
+    if (_redis_server_count < REDIS_SERVER_MAX)
     {
-        if (host && port)
+        int index = _redis_server_count;
+        redis_server *server = &_redis_servers_[index];
+        server->host = strdup(host);
+        server->port = port;
+        server->auth = auth ? strdup(auth) : NULL;
+        server->timeout = timeout ? timeout : 500;
+        server->weight = weight;
+
+        // registered dataspaces connect to the new server on first use
+        int ok = 1;
+        for (redis_dataspace *ptr = _redis_ds_list; ptr; ptr = ptr->next)
         {
-            _redis_server_.host = strdup(host);
-            _redis_server_.port = port;
-            _redis_server_.auth = auth ? strdup(auth) : NULL;
-            _redis_server_.timeout = timeout ? timeout : 500;
-            return 1;
+            ptr->links[index] = redis_link_create(ptr, index);
+            ok = ok && ptr->links[index];
+        }
+
+        _redis_server_count++;
+        if (ok && redis_ring_build())
+        {
+            return index;
+        }
+
+        _redis_server_count--;
+        for (redis_dataspace *ptr = _redis_ds_list; ptr; ptr = ptr->next)
+        {
+            ptr->links[index] = redis_link_free(ptr->links[index]);
         }
+        FREE_AND_NULL(server->host);
+        FREE_AND_NULL(server->auth);
+        errno = ENOMEM;
+        return -1;
     }
     errno = EINVAL;
-    return 0;
+    return -1;
 }
 
 /**
@@ -110,10 +547,16 @@ static redis_dataspace *redisDS_free(redis_dataspace *dataspace)
     if (dataspace)
     {
         next = dataspace->next;
+        redis_sliding_free(dataspace->sliding);
         FREE_AND_NULL(dataspace->name);
         dataspace->base = 0;
         FREE_AND_NULL(dataspace->prefix);
-        // dataspace->context = NULL;
+        for (int i = 0; i < REDIS_SERVER_MAX; i++)
+        {
+            dataspace->links[i] = redis_link_free(dataspace->links[i]);
+        }
+        redis_hot_free(dataspace->hot);
+        FREE_AND_NULL(dataspace->hedge);
         free(dataspace);
     }
     return next;
@@ -126,15 +569,38 @@ static redis_dataspace *redisDS_free(redis_dataspace *dataspace)
  */
 void redisDS_serverClose()
 {
-    FREE_AND_NULL(_redis_server_.host);
-    _redis_server_.port = 0;
-    FREE_AND_NULL(_redis_server_.auth);
-    _redis_server_.timeout = 0;
-
     for (redis_dataspace *ptr = _redis_ds_list; ptr; ptr = redisDS_free(ptr))
     {
-        ptr->context = redis_disconnect(ptr->context);
     }
+    _redis_ds_list = NULL;
+    __atomic_add_fetch(&_redis_hot_generation, 1, __ATOMIC_RELEASE);
+    while (_redis_ds_retired)
+    {
+        redis_dataspace *retired = _redis_ds_retired;
+        _redis_ds_retired = retired->retired;
+        // handed over to the registration that replaced it
+        retired->hot = NULL;
+        retired->hedge = NULL;
+        redisDS_free(retired);
+    }
+
+    for (int i = 0; i < _redis_server_count; i++)
+    {
+        FREE_AND_NULL(_redis_servers_[i].host);
+        _redis_servers_[i].port = 0;
+        FREE_AND_NULL(_redis_servers_[i].auth);
+        _redis_servers_[i].timeout = 0;
+        _redis_servers_[i].weight = 0;
+    }
+    _redis_server_count = 0;
+    FREE_AND_NULL(_redis_ring_);
+    _redis_ring_size = 0;
+
+    pthread_mutex_lock(&_redis_rate_mutex);
+    memset(_redis_rate_denied_, 0, sizeof(_redis_rate_denied_));
+    pthread_mutex_unlock(&_redis_rate_mutex);
+
+    redis_arena_drop();
 }
 
 /**
@@ -153,9 +619,32 @@ static redis_dataspace *redisDS_object(char *name, int base, char *prefix)
         dataspace->name = strdup(name);
         dataspace->prefix = prefix;
         dataspace->base = base;
-        // dataspace->context = NULL;
-        dataspace->context = redis_connect(_redis_server_.host, _redis_server_.port, _redis_server_.auth, _redis_server_.timeout, base);
+        dataspace->noreply = 0;
+        dataspace->failed = 0;
+        dataspace->cache = 0;
+        dataspace->approximate = 0;
+        dataspace->atomic = 0;
+        dataspace->buckets = 0;
+        dataspace->pinned = -1;
+        dataspace->purge = 0;
+        dataspace->hot = NULL;
+        dataspace->sliding = NULL;
+        dataspace->hedge = NULL;
         dataspace->next = NULL;
+        dataspace->retired = NULL;
+        for (int i = 0; i < REDIS_SERVER_MAX; i++)
+        {
+            dataspace->links[i] = NULL;
+        }
+        for (int i = 0; i < _redis_server_count; i++)
+        {
+            if (!(dataspace->links[i] = redis_link_create(dataspace, i)))
+            {
+                redisDS_free(dataspace);
+                return NULL;
+            }
+            dataspace->links[i]->context = redis_link_connect(dataspace->links[i]);
+        }
         return dataspace;
     }
     return NULL;
@@ -172,7 +661,7 @@ static redis_dataspace *redisDS_object(char *name, int base, char *prefix)
  */
 int redisDS_register(char *name, int base, char *prefix, ...)
 {
-    if (name && name[0])
+    if (name && name[0] && _redis_server_count)
     {
         va_list ap;
         va_start(ap, prefix);
@@ -181,8 +670,10 @@ int redisDS_register(char *name, int base, char *prefix, ...)
 
         if (object)
         {
+            pthread_mutex_lock(&_redis_ds_mutex);
             object->next = _redis_ds_list;
-            _redis_ds_list = object;
+            __atomic_store_n(&_redis_ds_list, object, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&_redis_ds_mutex);
             return 1;
         }
         errno = ENOMEM;
@@ -192,6 +683,116 @@ int redisDS_register(char *name, int base, char *prefix, ...)
     return 0;
 }
 
+/**
+ * Sets the dataspace option
+ *
+ * @param name
+ * @param option
+ * @param value
+ * @return int 1 | 0
+ */
+int redisDS_option(char *name, redis_option option, long long value)
+{
+    redis_dataspace *dataspace = name ? redisDS_get(name) : NULL;
+    if (dataspace)
+    {
+        switch (option)
+        {
+        case REDIS_DS_NOREPLY:
+            dataspace->noreply = value ? 1 : 0;
+            return 1;
+        case REDIS_DS_AUTOPIPELINE:
+            for (int i = 0; i < _redis_server_count; i++)
+            {
+                if (!value)
+                {
+                    redis_pipeline_stop(dataspace->links[i]);
+                }
+                else if (!redis_pipeline_start(dataspace->links[i]))
+                {
+                    return 0;
+                }
+            }
+            return 1;
+        case REDIS_DS_CACHE:
+            dataspace->cache = value > 0 ? value : 0;
+            return 1;
+        case REDIS_DS_APPROXIMATE:
+            dataspace->approximate = !!value;
+            return 1;
+        case REDIS_DS_ATOMIC:
+            dataspace->atomic = !!value;
+            return 1;
+        case REDIS_DS_MIGRATE_DELETE:
+            dataspace->purge = !!value;
+            return 1;
+        case REDIS_DS_BUCKETS:
+            dataspace->buckets = value > 0 ? value : 0;
+            return 1;
+        case REDIS_DS_HOTKEYS:
+            if (!dataspace->hot && value > 0)
+            {
+                redis_hot *hot = calloc(1, sizeof(redis_hot));
+                if (!hot)
+                {
+                    errno = ENOMEM;
+                    return 0;
+                }
+                pthread_mutex_init(&hot->mutex, NULL);
+                dataspace->hot = hot;
+            }
+            if (dataspace->hot)
+            {
+                __atomic_store_n(&dataspace->hot->sample, value > 0 ? value : 0, __ATOMIC_RELAXED);
+            }
+            return 1;
+        case REDIS_DS_SLIDING:
+            if ((value > 0) && !(redis_sliding_get(dataspace) && redis_sliding_start(dataspace->sliding)))
+            {
+                errno = ENOMEM;
+                return 0;
+            }
+            if (dataspace->sliding)
+            {
+                __atomic_store_n(&dataspace->sliding->ttl, value > 0 ? value : 0, __ATOMIC_RELAXED);
+            }
+            return 1;
+        case REDIS_DS_SLIDING_INTERVAL:
+            // kept until REDIS_DS_SLIDING starts the flusher
+            if ((value < 0) || !redis_sliding_get(dataspace))
+            {
+                errno = value < 0 ? EINVAL : ENOMEM;
+                return 0;
+            }
+            pthread_mutex_lock(&dataspace->sliding->mutex);
+            dataspace->sliding->interval = value;
+            pthread_mutex_unlock(&dataspace->sliding->mutex);
+            return 1;
+        case REDIS_DS_HEDGE:
+            if ((value < -1) || (value && !redis_hedge_get(dataspace)))
+            {
+                errno = value < -1 ? EINVAL : ENOMEM;
+                return 0;
+            }
+            if (dataspace->hedge)
+            {
+                __atomic_store_n(&dataspace->hedge->delay, value, __ATOMIC_RELAXED);
+            }
+            return 1;
+        case REDIS_DS_HEDGE_RATE:
+            if ((value < 0) || (value > 100) || !redis_hedge_get(dataspace))
+            {
+                errno = ((value < 0) || (value > 100)) ? EINVAL : ENOMEM;
+                return 0;
+            }
+            __atomic_store_n(&dataspace->hedge->rate, value, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    errno = EINVAL;
+    return 0;
+}
+
 /**
  * Gets the dataspace by name
  *
@@ -200,7 +801,8 @@ int redisDS_register(char *name, int base, char *prefix, ...)
  */
 static redis_dataspace *redisDS_get(char *name)
 {
-    for (redis_dataspace *ptr = _redis_ds_list; ptr; ptr = ptr->next)
+    // the registrations are replaced by atomic stores of redis_migrate_switch()
+    for (redis_dataspace *ptr = __atomic_load_n(&_redis_ds_list, __ATOMIC_ACQUIRE); ptr; ptr = __atomic_load_n(&ptr->next, __ATOMIC_ACQUIRE))
     {
         if (!strcmp(name, ptr->name))
         {
@@ -218,11 +820,11 @@ static redis_dataspace *redisDS_get(char *name)
  *
  * @return char*
  */
-static char *redis_type(redis_dataspace *dataspace, char *key)
+static char *redis_type(redis_link *link, char *key)
 {
     char *ret = NULL;
 
-    redisReply *reply = redis_command(dataspace, "TYPE %s", key);
+    redisReply *reply = redis_read_command(link, "TYPE %s", key);
     if (reply)
     {
         ret = reply ? strdup(reply->str) : NULL;
@@ -232,37 +834,56 @@ static char *redis_type(redis_dataspace *dataspace, char *key)
     return ret;
 }
 
-static cJSON *redis_string(redis_dataspace *dataspace, char *key)
+/**
+ * Reads the string key, in the approximate mode a value with the HYLL magic
+ * is the HyperLogLog of the append and is counted by PFCOUNT,
+ * a plain string is kept when PFCOUNT refuses it
+ *
+ * @param link
+ * @param key prefixed key
+ * @param arena
+ * @return cJSON*
+ */
+static cJSON *redis_string(redis_link *link, char *key, redis_arena *arena)
 {
     cJSON *json = NULL;
 
-    redisReply *reply = redis_command(dataspace, "GET %s", key);
-    if (REDIS_IS_STRING(reply))
+    redisReply *reply = redis_read_command(link, "GET %s", key);
+    if (link->dataspace->approximate && REDIS_IS_STRING(reply) && (reply->len >= 4) && !memcmp(reply->str, "HYLL", 4))
+    {
+        redisReply *count = redis_read_command(link, "PFCOUNT %s", key);
+        if (REDIS_IS_INT(count))
+        {
+            json = redis_json_number(arena, (double)count->integer);
+        }
+        FREE_REPLY(count);
+    }
+    if (!json && REDIS_IS_STRING(reply))
     {
-        json = cJSON_CreateString(reply->str);
+        json = redis_json_string(arena, reply->str);
     }
-    else if (REDIS_IS_INT(reply))
+    else if (!json && REDIS_IS_INT(reply))
     {
-        json = cJSON_CreateNumber((double)reply->integer);
+        json = redis_json_number(arena, (double)reply->integer);
     }
     FREE_REPLY(reply);
 
     return json;
 }
 
-static cJSON *redis_hash(redis_dataspace *dataspace, char *key)
+static cJSON *redis_hash(redis_link *link, char *key, redis_arena *arena)
 {
     cJSON *json = NULL;
 
-    redisReply *reply = redis_command(dataspace, "HGETALL %s", key);
+    redisReply *reply = redis_read_command(link, "HGETALL %s", key);
     if (REDIS_IS_ARRAY(reply) && reply->elements >= 2)
     {
-        json = cJSON_CreateObject();
-        for (size_t i = 0; i < (reply->elements / 2); i++)
+        json = redis_json_container(arena, cJSON_Object);
+        for (size_t i = 0; json && i < (reply->elements / 2); i++)
         {
             char *field = (reply->element)[i * 2]->str;
             char *value = reply->element[i * 2 + 1]->str;
-            cJSON_AddStringToObject(json, field, value);
+            redis_json_add(arena, json, field, redis_json_string(arena, value));
         }
     }
     FREE_REPLY(reply);
@@ -270,26 +891,43 @@ static cJSON *redis_hash(redis_dataspace *dataspace, char *key)
     return json;
 }
 
-static void cJSON_AddStringToArray(cJSON *json, const char *string)
+static cJSON *redis_list(redis_link *link, char *key, redis_arena *arena)
 {
-    cJSON *jstr = cJSON_CreateString(string);
-    if (!cJSON_AddItemToArray(json, jstr))
+    cJSON *json = NULL;
+
+    redisReply *reply = redis_read_command(link, "LRANGE %s 0 -1", key);
+    if (REDIS_IS_ARRAY(reply))
     {
-        cJSON_Delete(jstr);
+        json = redis_json_container(arena, cJSON_Array);
+        for (size_t i = 0; json && i < reply->elements; i++)
+        {
+            redis_json_add(arena, json, NULL, redis_json_string(arena, reply->element[i]->str));
+        }
     }
+    FREE_REPLY(reply);
+
+    return json;
 }
 
-static cJSON *redis_list(redis_dataspace *dataspace, char *key)
+/**
+ *
+ *
+ * @param link
+ * @param key
+ * @param arena
+ * @return cJSON*
+ */
+static cJSON *redis_set(redis_link *link, char *key, redis_arena *arena)
 {
     cJSON *json = NULL;
 
-    redisReply *reply = redis_command(dataspace, "LRANGE %s 0 -1", key);
+    redisReply *reply = redis_read_command(link, "SMEMBERS %s", key);
     if (REDIS_IS_ARRAY(reply))
     {
-        json = cJSON_CreateArray();
-        for (size_t i = 0; i < reply->elements; i++)
+        json = redis_json_container(arena, cJSON_Array);
+        for (size_t i = 0; json && i < reply->elements; i++)
         {
-            cJSON_AddStringToArray(json, reply->element[i]->str);
+            redis_json_add(arena, json, NULL, redis_json_string(arena, reply->element[i]->str));
         }
     }
     FREE_REPLY(reply);
@@ -298,26 +936,56 @@ static cJSON *redis_list(redis_dataspace *dataspace, char *key)
 }
 
 /**
+ * Reads the value of the full key by its type
  *
- *
- * @param dataspace
- * @param key
+ * @param link
+ * @param key prefixed key
+ * @param arena result arena or NULL for the cJSON allocator
+ * @param pttl set to the PTTL of the key, it comes in the round trip of TYPE | NULL
  * @return cJSON*
  */
-static cJSON *redis_set(redis_dataspace *dataspace, char *key)
+static cJSON *redis_read(redis_link *link, char *key, redis_arena *arena, long long *pttl)
 {
     cJSON *json = NULL;
 
-    redisReply *reply = redis_command(dataspace, "SMEMBERS %s", key);
-    if (REDIS_IS_ARRAY(reply))
+    char *type = NULL;
+    if (pttl)
     {
-        json = cJSON_CreateArray();
-        for (size_t i = 0; i < reply->elements; i++)
+        char *commands[2] = {NULL, NULL};
+        int lengths[2] = {redisFormatCommand(&commands[0], "TYPE %s", key), redisFormatCommand(&commands[1], "PTTL %s", key)};
+        redisReply *replies[2] = {NULL, NULL};
+        if (redis_read_pair(link, commands, lengths, replies) && replies[0] && (REDIS_REPLY_STATUS == replies[0]->type))
         {
-            cJSON_AddStringToArray(json, reply->element[i]->str);
+            type = strdup(replies[0]->str);
         }
+        *pttl = REDIS_IS_INT(replies[1]) ? replies[1]->integer : -2;
+        FREE_REPLY(replies[0]);
+        FREE_REPLY(replies[1]);
     }
-    FREE_REPLY(reply);
+    else
+    {
+        type = redis_type(link, key);
+    }
+    if (type)
+    {
+        if (stringEQUALS(type, "string"))
+        {
+            json = redis_string(link, key, arena);
+        }
+        else if (stringEQUALS(type, "hash"))
+        {
+            json = redis_hash(link, key, arena);
+        }
+        else if (stringEQUALS(type, "list"))
+        {
+            json = redis_list(link, key, arena);
+        }
+        else if (stringEQUALS(type, "set"))
+        {
+            json = redis_set(link, key, arena);
+        }
+    }
+    FREE_AND_NULL(type);
 
     return json;
 }
@@ -335,36 +1003,20 @@ cJSON *redisDS_read(char *name, char *key, ...)
     redis_dataspace *dataspace = redisDS_get(name);
     if (dataspace)
     {
-        cJSON *json = NULL;
-
         va_list ap;
         va_start(ap, key);
         char *basekey = vaprint(key, ap);
         va_end(ap);
         char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
         FREE_AND_NULL(basekey);
+        redis_hot_sample(dataspace, fullkey);
 
-        char *type = redis_type(dataspace, fullkey);
-        if (type)
+        int plain = 0;
+        cJSON *json = redis_fetch(dataspace, fullkey, NULL, &plain);
+        if (json)
         {
-            if (stringEQUALS(type, "string"))
-            {
-                json = redis_string(dataspace, fullkey);
-            }
-            else if (stringEQUALS(type, "hash"))
-            {
-                json = redis_hash(dataspace, fullkey);
-            }
-            else if (stringEQUALS(type, "list"))
-            {
-                json = redis_list(dataspace, fullkey);
-            }
-            else if (stringEQUALS(type, "set"))
-            {
-                json = redis_set(dataspace, fullkey);
-            }
+            redis_sliding_touch(dataspace, fullkey, plain);
         }
-        FREE_AND_NULL(type);
         FREE_AND_NULL(fullkey);
 
         return json;
@@ -373,27 +1025,104 @@ cJSON *redisDS_read(char *name, char *key, ...)
     return NULL;
 }
 
-static long long redis_ttl(redis_dataspace *dataspace, char *key)
+/**
+ * Reads the key value from the dataspace into an arena.
+ * The whole tree is freed at once by redisDS_release(),
+ * it must not be passed to cJSON_Delete() or modified by cJSON.
+ *
+ * @param name
+ * @param key
+ * @param ...
+ * @return cJSON*
+ */
+cJSON *redisDS_readArena(char *name, char *key, ...)
 {
-    long long ret = -3;
-
-    redisReply *reply = redis_command(dataspace, "TTL %s", key);
-    if (REDIS_IS_INT(reply))
+    redis_dataspace *dataspace = redisDS_get(name);
+    if (dataspace)
     {
-        ret = reply->integer;
-    }
-    FREE_REPLY(reply);
-
-    return ret;
-}
-
-static long long redis_expire(redis_dataspace *dataspace, char *key, long long expire)
+        va_list ap;
+        va_start(ap, key);
+        char *basekey = vaprint(key, ap);
+        va_end(ap);
+        char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
+        FREE_AND_NULL(basekey);
+        redis_hot_sample(dataspace, fullkey);
+
+        cJSON *json = NULL;
+        int plain = 0;
+        redis_arena *arena = redis_arena_create();
+        if (arena)
+        {
+            json = redis_fetch(dataspace, fullkey, arena, &plain);
+            if (!json)
+            {
+                redis_arena_free(arena);
+            }
+            else
+            {
+                // the root is tagged for redisDS_release()
+                arena->magic = REDIS_ARENA_MAGIC;
+                json->string = (char *)_redis_arena_tag_;
+                json->type |= cJSON_StringIsConst;
+                redis_sliding_touch(dataspace, fullkey, plain);
+            }
+        }
+        else
+        {
+            errno = ENOMEM;
+        }
+        FREE_AND_NULL(fullkey);
+
+        return json;
+    }
+    errno = EINVAL;
+    return NULL;
+}
+
+/**
+ * Releases the tree returned by redisDS_readArena().
+ * Only its root is accepted, other trees and nodes fail with errno = EINVAL.
+ *
+ * @param json
+ */
+void redisDS_release(cJSON *json)
+{
+    if (json)
+    {
+        redis_arena *arena = (json->string == _redis_arena_tag_) ? (redis_arena *)((char *)json - offsetof(redis_arena, data)) : NULL;
+        if (!arena || (REDIS_ARENA_MAGIC != arena->magic))
+        {
+            syslog(LOG_ERR, "RELEASE of a tree not read by redisDS_readArena()");
+            errno = EINVAL;
+            return;
+        }
+        arena->magic = 0;
+        json->string = NULL;
+        redis_arena_free(arena);
+    }
+}
+
+static long long redis_ttl(redis_link *link, char *key)
+{
+    long long ret = -3;
+
+    redisReply *reply = redis_command(link, "TTL %s", key);
+    if (REDIS_IS_INT(reply))
+    {
+        ret = reply->integer;
+    }
+    FREE_REPLY(reply);
+
+    return ret;
+}
+
+static long long redis_expire(redis_link *link, char *key, long long expire)
 {
-    long long oldttl = redis_ttl(dataspace, key);
+    long long oldttl = redis_ttl(link, key);
     int ret = 0;
     if (oldttl <= 0)
     {
-        redisReply *reply = redis_command(dataspace, "EXPIRE %s %lld", key, expire);
+        redisReply *reply = redis_command(link, "EXPIRE %s %lld", key, expire);
         ret = REDIS_IS_OK(reply);
         FREE_REPLY(reply);
     }
@@ -425,15 +1154,33 @@ long long redisDS_set(char *name, char *key, char *value, long long ttl, ...)
         va_end(ap);
         char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
         FREE_AND_NULL(basekey);
+        redis_hot_sample(dataspace, fullkey);
+        redis_link *link = redis_route(dataspace, fullkey);
+
+        redis_cache_drop(dataspace, fullkey);
 
         long long newttl = 0;
-        redisReply *reply = redis_command(dataspace, "SET %s %s", fullkey, fullval);
-        syslog(LOG_INFO, "SET %s %s = %d", fullkey, fullval, reply->type);
-        if (REDIS_IS_OK(reply))
+        if (dataspace->buckets)
         {
-            newttl = redis_expire(dataspace, fullkey, ttl);
+            newttl = redis_bucket_set(dataspace, fullkey, fullval, ttl) ? ttl : 0;
+        }
+        else if (dataspace->noreply)
+        {
+            if (redis_send(link, fullkey, ttl, "SET %s %s", fullkey, fullval))
+            {
+                newttl = ttl;
+            }
+        }
+        else
+        {
+            redisReply *reply = redis_command(link, "SET %s %s", fullkey, fullval);
+            syslog(LOG_INFO, "SET %s %s = %d", fullkey, fullval, reply ? reply->type : -1);
+            if (REDIS_IS_OK(reply))
+            {
+                newttl = redis_expire(link, fullkey, ttl);
+            }
+            FREE_REPLY(reply);
         }
-        FREE_REPLY(reply);
 
         FREE_AND_NULL(fullval);
         FREE_AND_NULL(fullkey);
@@ -445,14 +1192,295 @@ long long redisDS_set(char *name, char *key, char *value, long long ttl, ...)
 }
 
 /**
- * Appends a string to the key of type SET in the dataspace
+ * Formats the chunk of keys: one MSET without a TTL, SET EX per key otherwise,
+ * wrapped in MULTI/EXEC for an atomic dataspace
+ *
+ * @param fullkeys
+ * @param values
+ * @param count keys of the chunk
+ * @param ttl
+ * @param atomic
+ * @param commands count + 2 slots
+ * @param lengths
+ * @return int formatted commands | 0 out of memory
+ */
+static int redis_set_format(char **fullkeys, char **values, int count, long long ttl, int atomic, char **commands, int *lengths)
+{
+    int total = 0;
+    int ok = 1;
+    if (atomic)
+    {
+        lengths[total] = redisFormatCommand(&commands[total], "MULTI");
+        ok = (lengths[total++] > 0);
+    }
+    if (ok && (ttl > 0))
+    {
+        for (int i = 0; ok && (i < count); i++)
+        {
+            lengths[total] = redisFormatCommand(&commands[total], "SET %s %s EX %lld", fullkeys[i], values[i], ttl);
+            ok = (lengths[total++] > 0);
+        }
+    }
+    else if (ok)
+    {
+        const char **argv = malloc((2 * count + 1) * sizeof(char *));
+        commands[total] = NULL;
+        if (argv)
+        {
+            argv[0] = "MSET";
+            for (int i = 0; i < count; i++)
+            {
+                argv[2 * i + 1] = fullkeys[i];
+                argv[2 * i + 2] = values[i];
+            }
+            long long len = redisFormatCommandArgv(&commands[total], 2 * count + 1, argv, NULL);
+            lengths[total] = (int)len;
+        }
+        ok = argv && (lengths[total++] > 0);
+        FREE_AND_NULL(argv);
+    }
+    if (ok && atomic)
+    {
+        lengths[total] = redisFormatCommand(&commands[total], "EXEC");
+        ok = (lengths[total++] > 0);
+    }
+
+    if (!ok)
+    {
+        for (int i = 0; i < total; i++)
+        {
+            FREE_AND_NULL(commands[i]);
+        }
+        return 0;
+    }
+    return total;
+}
+
+/**
+ * Writes the chunk of keys of one server in one round trip
+ * and marks the written keys in the status
+ *
+ * @param link
+ * @param fullkeys
+ * @param values
+ * @param index positions of the keys in the status
+ * @param count keys of the chunk, at most REDIS_SET_CHUNK
+ * @param ttl
+ * @param status | NULL
+ * @return long long written keys
+ */
+static long long redis_set_chunk(redis_link *link, char **fullkeys, char **values, int *index, int count, long long ttl, int *status)
+{
+    redis_dataspace *dataspace = link->dataspace;
+    int atomic = dataspace->atomic;
+    char *commands[REDIS_SET_CHUNK + 2];
+    int lengths[REDIS_SET_CHUNK + 2];
+    int total = redis_set_format(fullkeys, values, count, ttl, atomic, commands, lengths);
+    if (!total)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    long long written = 0;
+    redisReply *replies[REDIS_SET_CHUNK + 2];
+    int replied = 0;
+    if (link->pipeline)
+    {
+        // one request, no command of another thread gets inside MULTI/EXEC
+        int length = 0;
+        for (int i = 0; i < total; i++)
+        {
+            length += lengths[i];
+        }
+        char *chunk = malloc(length + 1);
+        for (int i = 0, at = 0; chunk && (i < total); at += lengths[i++])
+        {
+            memcpy(chunk + at, commands[i], lengths[i]);
+        }
+        if (!chunk)
+        {
+            errno = ENOMEM;
+        }
+        else if (dataspace->noreply)
+        {
+            int ok = redis_pipeline_chunk(link, chunk, length, total, NULL);
+            for (int i = 0; ok && (i < count); i++)
+            {
+                if (status)
+                {
+                    status[index[i]] = 1;
+                }
+                written++;
+            }
+        }
+        else
+        {
+            replied = redis_pipeline_chunk(link, chunk, length, total, replies);
+        }
+    }
+    else if (dataspace->noreply)
+    {
+        if (!link->context)
+        {
+            link->context = redis_link_connect(link);
+        }
+        int ok = (NULL != link->context);
+        for (int i = 0; ok && (i < total); i++)
+        {
+            ok = (REDIS_OK == redisAppendFormattedCommand(link->context, commands[i], lengths[i]));
+            link->pending += ok;
+        }
+        ok = redis_flush(link) && ok;
+        for (int i = 0; ok && (i < count); i++)
+        {
+            if (status)
+            {
+                status[index[i]] = 1;
+            }
+            written++;
+        }
+    }
+    else
+    {
+        replied = redis_pipelined(link, commands, lengths, total, replies);
+    }
+
+    if (replied)
+    {
+        // the replies of the keys, EXEC returns them as an array
+        redisReply *exec = atomic ? replies[total - 1] : NULL;
+        redisReply **results = atomic ? (REDIS_IS_ARRAY(exec) ? exec->element : NULL) : replies;
+        size_t size = atomic ? (REDIS_IS_ARRAY(exec) ? exec->elements : 0) : (size_t)total;
+        for (int i = 0; i < count; i++)
+        {
+            size_t at = (ttl > 0) ? (size_t)i : 0;
+            redisReply *reply = (at < size) ? results[at] : NULL;
+            int done = reply && (REDIS_REPLY_STATUS == reply->type);
+            if (!done)
+            {
+                syslog(LOG_WARNING, "SET %s: '%s'", fullkeys[i], reply && reply->str ? reply->str : "no reply");
+            }
+            if (status)
+            {
+                status[index[i]] = done;
+            }
+            written += done;
+        }
+        for (int i = 0; i < total; i++)
+        {
+            FREE_REPLY(replies[i]);
+        }
+    }
+
+    for (int i = 0; i < total; i++)
+    {
+        FREE_AND_NULL(commands[i]);
+    }
+    return written;
+}
+
+/**
+ * Sets the string values of many keys in the dataspace.
+ * The keys are grouped by server and written in chunks of REDIS_SET_CHUNK keys,
+ * one round trip per chunk: MSET without a TTL, pipelined SET EX with it.
+ * With REDIS_DS_ATOMIC every chunk is written inside MULTI/EXEC.
+ * Bucketed dataspaces write key by key like redisDS_set().
+ *
+ * @param name
+ * @param keys unprefixed keys, not formats
+ * @param values
+ * @param n count of keys
+ * @param ttl seconds, <= 0 without expiration
+ * @param status n slots set to 1 written (sent for no-reply writes) | 0 failed, or NULL
+ * @return long long written keys
+ */
+long long redisDS_setMany(char *name, char **keys, char **values, int n, long long ttl, int *status)
+{
+    redis_dataspace *dataspace = name ? redisDS_get(name) : NULL;
+    if (!dataspace || (n < 0) || (n && (!keys || !values)))
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    char **fullkeys = calloc(n + 1, sizeof(char *));
+    int *servers = calloc(n + 1, sizeof(int));
+    if (!fullkeys || !servers)
+    {
+        FREE_AND_NULL(fullkeys);
+        FREE_AND_NULL(servers);
+        errno = ENOMEM;
+        return 0;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (status)
+        {
+            status[i] = 0;
+        }
+        if (keys[i] && values[i] && (fullkeys[i] = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", keys[i])))
+        {
+            redis_hot_sample(dataspace, fullkeys[i]);
+            redis_cache_drop(dataspace, fullkeys[i]);
+            servers[i] = redis_route(dataspace, fullkeys[i])->server;
+        }
+    }
+
+    long long written = 0;
+    if (dataspace->buckets)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            int done = fullkeys[i] && redis_bucket_set(dataspace, fullkeys[i], values[i], ttl);
+            if (status)
+            {
+                status[i] = done;
+            }
+            written += done;
+        }
+    }
+    for (int server = 0; !dataspace->buckets && (server < _redis_server_count); server++)
+    {
+        char *chunk[REDIS_SET_CHUNK];
+        char *chunkvalues[REDIS_SET_CHUNK];
+        int index[REDIS_SET_CHUNK];
+        int count = 0;
+        for (int i = 0; i <= n; i++)
+        {
+            if ((i < n) && fullkeys[i] && (servers[i] == server))
+            {
+                chunk[count] = fullkeys[i];
+                chunkvalues[count] = values[i];
+                index[count++] = i;
+            }
+            if (count && ((REDIS_SET_CHUNK == count) || (i == n)))
+            {
+                written += redis_set_chunk(dataspace->links[server], chunk, chunkvalues, index, count, ttl, status);
+                count = 0;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        FREE_AND_NULL(fullkeys[i]);
+    }
+    free(fullkeys);
+    free(servers);
+    return written;
+}
+
+/**
+ * Appends a string to the key of type SET in the dataspace,
+ * or to the HyperLogLog in the approximate mode
  *
  * @param dataspace
  * @param key
  * @param value
  * @param ttl
  * @param ...
- * @return long long
+ * @return long long count of unique members
  */
 long long redisDS_append(char *name, char *key, char *value, long long ttl, ...)
 {
@@ -468,18 +1496,31 @@ long long redisDS_append(char *name, char *key, char *value, long long ttl, ...)
         va_end(ap);
         char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
         FREE_AND_NULL(basekey);
+        redis_hot_sample(dataspace, fullkey);
+        redis_link *link = redis_route(dataspace, fullkey);
+
+        redis_cache_drop(dataspace, fullkey);
 
-        redisReply *reply = redis_command(dataspace, "SADD %s %s", fullkey, fullval);
-        if (REDIS_IS_OK(reply))
+        char *add = dataspace->approximate ? "PFADD" : "SADD";
+        if (dataspace->noreply)
         {
-            redis_expire(dataspace, fullkey, ttl);
+            redis_send(link, fullkey, ttl, "%s %s %s", add, fullkey, fullval);
         }
-        FREE_REPLY(reply);
-
-        reply = redis_command(dataspace, "SCARD %s", fullkey);
-        if (REDIS_IS_INT(reply))
+        else
         {
-            count = reply->integer;
+            redisReply *reply = redis_command(link, "%s %s %s", add, fullkey, fullval);
+            if (REDIS_IS_OK(reply))
+            {
+                redis_expire(link, fullkey, ttl);
+            }
+            FREE_REPLY(reply);
+
+            reply = redis_command(link, dataspace->approximate ? "PFCOUNT %s" : "SCARD %s", fullkey);
+            if (REDIS_IS_INT(reply))
+            {
+                count = reply->integer;
+            }
+            FREE_REPLY(reply);
         }
 
         FREE_AND_NULL(fullval);
@@ -514,14 +1555,29 @@ long long redisDS_increment(char *name, char *key, int value, long long ttl, ...
         va_end(ap);
         char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
         FREE_AND_NULL(basekey);
+        redis_hot_sample(dataspace, fullkey);
+        redis_link *link = redis_route(dataspace, fullkey);
 
-        redisReply *reply = redis_command(dataspace, "INCRBY %s %d", fullkey, value);
-        if (REDIS_IS_OK(reply) && REDIS_IS_INT(reply))
+        redis_cache_drop(dataspace, fullkey);
+
+        if (dataspace->buckets)
         {
-            count = reply->integer;
-            redis_expire(dataspace, fullkey, ttl);
+            count = redis_bucket_increment(dataspace, fullkey, value, ttl);
+        }
+        else if (dataspace->noreply)
+        {
+            redis_send(link, fullkey, ttl, "INCRBY %s %d", fullkey, value);
+        }
+        else
+        {
+            redisReply *reply = redis_command(link, "INCRBY %s %d", fullkey, value);
+            if (REDIS_IS_OK(reply) && REDIS_IS_INT(reply))
+            {
+                count = reply->integer;
+                redis_expire(link, fullkey, ttl);
+            }
+            FREE_REPLY(reply);
         }
-        FREE_REPLY(reply);
 
         FREE_AND_NULL(fullkey);
 
@@ -532,85 +1588,284 @@ long long redisDS_increment(char *name, char *key, int value, long long ttl, ...
 }
 
 /**
- * !!! FOR TESTING ONLY !!!
+ * Formats the push of the values, strings are pushed as they are,
+ * other items as unformatted JSON
  *
- * @param dataspace
+ * @param command RPUSH | LPUSH
  * @param key
- * @param value
- * @param ttl
- * @param ...
- * @return long long
+ * @param values item or array of items
+ * @param length of the formatted command
+ * @return char* | NULL
  */
-static long long redisDS_write(redis_dataspace *dataspace, char *key, cJSON *value, long long ttl, ...)
+static char *redis_push_format(char *command, char *key, cJSON *values, int *length)
 {
-    long long count = 0;
-
-    if (dataspace)
+    int count = cJSON_IsArray(values) ? cJSON_GetArraySize(values) : 1;
+    const char **argv = calloc(count + 2, sizeof(char *));
+    char **printed = calloc(count, sizeof(char *));
+    char *formatted = NULL;
+    int argc = 2;
+    if (argv && printed && count)
     {
-        va_list ap;
-        va_start(ap, ttl);
-        char *basekey = vaprint(key, ap);
-        va_end(ap);
-        char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
-        FREE_AND_NULL(basekey);
-
-        redisReply *reply = NULL;
-        cJSON *element = NULL;
-        if (value)
+        argv[0] = command;
+        argv[1] = key;
+        cJSON *item = cJSON_IsArray(values) ? values->child : values;
+        for (; item && (argc < count + 2); item = cJSON_IsArray(values) ? item->next : NULL)
         {
-            switch (value->type)
+            if (cJSON_IsString(item))
             {
-            case cJSON_String:
-                reply = redis_command(dataspace, "SET %s %s", fullkey, value->valuestring);
-                syslog(LOG_DEBUG, "SET %s %s = %d", fullkey, value->valuestring, reply ? reply->type : -1);
-                redis_expire(dataspace, fullkey, ttl);
-                FREE_REPLY(reply);
-                count++;
-                break;
-            case cJSON_Array:
-                cJSON_ArrayForEach(element, value)
-                {
-                    reply = redis_command(dataspace, "SADD %s %s", fullkey, element->valuestring);
-                    FREE_REPLY(reply);
-                }
-                redis_expire(dataspace, fullkey, ttl);
-                count++;
-                break;
-            case cJSON_Object:
-                cJSON_ArrayForEach(element, value)
-                {
-                    reply = redis_command(dataspace, "HSET %s %s %s", fullkey, element->string, element->valuestring);
-                    FREE_REPLY(reply);
-                }
-                redis_expire(dataspace, fullkey, ttl);
-                count++;
-                break;
+                argv[argc++] = item->valuestring;
+            }
+            else if ((printed[argc - 2] = cJSON_PrintUnformatted(item)))
+            {
+                argv[argc] = printed[argc - 2];
+                argc++;
             }
         }
-        FREE_REPLY(reply);
-        FREE_AND_NULL(fullkey);
+        long long len = (argc > 2) ? redisFormatCommandArgv(&formatted, argc, argv, NULL) : -1;
+        *length = (int)len;
+        if (len < 0)
+        {
+            formatted = NULL;
+        }
     }
-    return count;
+    for (int i = 0; printed && (i < count); i++)
+    {
+        FREE_AND_NULL(printed[i]);
+    }
+    FREE_AND_NULL(printed);
+    FREE_AND_NULL(argv);
+    return formatted;
 }
 
 /**
- * !!! FOR TESTING ONLY !!!
+ * Returns the length of the list after the push capped at maxlen
  *
- * @param dataspace
- * @param object
- * @param ttl
- * @param ...
+ * @param reply integer reply of the push
+ * @param maxlen
  * @return long long
  */
-long long redisDS_store(char *name, cJSON *object, long long ttl)
+static long long redis_push_length(redisReply *reply, long long maxlen)
 {
-    redis_dataspace *dataspace = redisDS_get(name);
-    if (dataspace)
-    {
-        long long count = 0;
+    long long cap = maxlen < 0 ? -maxlen : maxlen;
+    return (maxlen && (reply->integer > cap)) ? cap : reply->integer;
+}
 
-        cJSON *element = NULL;
-        cJSON_ArrayForEach(element, object)
+/**
+ * Pushes the values to the key of type LIST in the dataspace and caps the list.
+ * The push, LTRIM and EXPIRE are pipelined in one round trip,
+ * the TTL is renewed by every push.
+ *
+ * @param name
+ * @param key
+ * @param values string, number or array of them
+ * @param maxlen > 0 RPUSH and keep the last maxlen items,
+ *               < 0 LPUSH and keep the first -maxlen items, 0 RPUSH without a cap
+ * @param ttl seconds, <= 0 keeps the TTL of the key
+ * @param ...
+ * @return long long length of the list | 0 for no-reply writes or on error
+ */
+long long redisDS_push(char *name, char *key, cJSON *values, long long maxlen, long long ttl, ...)
+{
+    redis_dataspace *dataspace = redisDS_get(name);
+    if (!dataspace || !values || (cJSON_IsArray(values) && !values->child))
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    va_list ap;
+    va_start(ap, ttl);
+    char *basekey = vaprint(key, ap);
+    va_end(ap);
+    char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
+    FREE_AND_NULL(basekey);
+    redis_hot_sample(dataspace, fullkey);
+    redis_link *link = redis_route(dataspace, fullkey);
+
+    redis_cache_drop(dataspace, fullkey);
+
+    char *commands[3] = {NULL, NULL, NULL};
+    int lengths[3] = {0, 0, 0};
+    int count = 0;
+    commands[count] = redis_push_format(maxlen < 0 ? "LPUSH" : "RPUSH", fullkey, values, &lengths[count]);
+    int ok = (NULL != commands[count++]);
+    if (ok && maxlen)
+    {
+        lengths[count] = maxlen > 0 ? redisFormatCommand(&commands[count], "LTRIM %s %lld -1", fullkey, -maxlen)
+                                    : redisFormatCommand(&commands[count], "LTRIM %s 0 %lld", fullkey, -maxlen - 1);
+        ok = (lengths[count++] > 0);
+    }
+    if (ok && (ttl > 0))
+    {
+        lengths[count] = redisFormatCommand(&commands[count], "EXPIRE %s %lld", fullkey, ttl);
+        ok = (lengths[count++] > 0);
+    }
+
+    long long length = 0;
+    if (!ok)
+    {
+        errno = ENOMEM;
+    }
+    else if (link->pipeline)
+    {
+        // one request, the push reply comes back with the trim and the expire
+        int size = 0;
+        for (int i = 0; i < count; i++)
+        {
+            size += lengths[i];
+        }
+        char *chunk = malloc(size);
+        for (int i = 0, at = 0; chunk && (i < count); at += lengths[i++])
+        {
+            memcpy(chunk + at, commands[i], lengths[i]);
+        }
+        redisReply *replies[3] = {NULL, NULL, NULL};
+        if (!chunk)
+        {
+            errno = ENOMEM;
+        }
+        else if (dataspace->noreply)
+        {
+            redis_pipeline_chunk(link, chunk, size, count, NULL);
+        }
+        else if (redis_pipeline_chunk(link, chunk, size, count, replies))
+        {
+            length = redis_push_length(replies[0], maxlen);
+        }
+        if (chunk && !dataspace->noreply && !REDIS_IS_INT(replies[0]))
+        {
+            syslog(LOG_ERR, "PUSH %s: '%s'", fullkey, replies[0] && replies[0]->str ? replies[0]->str : "no reply");
+        }
+        for (int i = 0; i < count; i++)
+        {
+            FREE_REPLY(replies[i]);
+        }
+    }
+    else if (dataspace->noreply)
+    {
+        if (!link->context)
+        {
+            link->context = redis_link_connect(link);
+        }
+        for (int i = 0; link->context && (i < count); i++)
+        {
+            if (REDIS_OK == redisAppendFormattedCommand(link->context, commands[i], lengths[i]))
+            {
+                link->pending++;
+            }
+        }
+        redis_flush(link);
+    }
+    else
+    {
+        redisReply *reply = redis_formatted(link, commands, lengths, count);
+        if (REDIS_IS_INT(reply))
+        {
+            length = redis_push_length(reply, maxlen);
+        }
+        else
+        {
+            syslog(LOG_ERR, "PUSH %s: '%s'", fullkey, reply && reply->str ? reply->str : "no reply");
+        }
+        FREE_REPLY(reply);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        FREE_AND_NULL(commands[i]);
+    }
+    FREE_AND_NULL(fullkey);
+
+    return length;
+}
+
+/**
+ * !!! FOR TESTING ONLY !!!
+ *
+ * @param dataspace
+ * @param key
+ * @param value
+ * @param ttl
+ * @param ...
+ * @return long long
+ */
+static long long redisDS_write(redis_dataspace *dataspace, char *key, cJSON *value, long long ttl, ...)
+{
+    long long count = 0;
+
+    if (dataspace)
+    {
+        va_list ap;
+        va_start(ap, ttl);
+        char *basekey = vaprint(key, ap);
+        va_end(ap);
+        char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
+        FREE_AND_NULL(basekey);
+        redis_link *link = redis_route(dataspace, fullkey);
+        redis_cache_drop(dataspace, fullkey);
+
+        redisReply *reply = NULL;
+        cJSON *element = NULL;
+        if (value)
+        {
+            switch (value->type)
+            {
+            case cJSON_String:
+                reply = redis_command(link, "SET %s %s", fullkey, value->valuestring);
+                syslog(LOG_DEBUG, "SET %s %s = %d", fullkey, value->valuestring, reply ? reply->type : -1);
+                redis_expire(link, fullkey, ttl);
+                FREE_REPLY(reply);
+                count++;
+                break;
+            case cJSON_Array:
+                cJSON_ArrayForEach(element, value)
+                {
+                    reply = redis_command(link, "SADD %s %s", fullkey, element->valuestring);
+                    FREE_REPLY(reply);
+                }
+                redis_expire(link, fullkey, ttl);
+                count++;
+                break;
+            case cJSON_Object:
+                cJSON_ArrayForEach(element, value)
+                {
+                    reply = redis_command(link, "HSET %s %s %s", fullkey, element->string, element->valuestring);
+                    FREE_REPLY(reply);
+                }
+                redis_expire(link, fullkey, ttl);
+                count++;
+                break;
+            }
+        }
+        FREE_REPLY(reply);
+        FREE_AND_NULL(fullkey);
+    }
+    return count;
+}
+
+/**
+ * !!! FOR TESTING ONLY !!!
+ *
+ * @param dataspace
+ * @param object
+ * @param ttl
+ * @param ...
+ * @return long long
+ */
+long long redisDS_store(char *name, cJSON *object, long long ttl)
+{
+    redis_dataspace *dataspace = redisDS_get(name);
+    if (dataspace)
+    {
+        if (_redis_server_count > 1)
+        {
+            return redis_batch_write(dataspace, object, ttl);
+        }
+
+        long long count = 0;
+
+        cJSON *element = NULL;
+        cJSON_ArrayForEach(element, object)
         {
             count += redisDS_write(dataspace, "%s", element, ttl, element->string);
         }
@@ -656,7 +1911,9 @@ static struct redisContext *redis_connect(char *rhost, int rport, char *rauth, i
     // struct timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
 
     // struct redisContext *redis = redisConnectWithTimeout(rhost, rport, tv);
-    struct redisContext *redis = redisConnect(rhost, rport);
+    long long left = redis_deadline_left();
+    struct timeval tv = {left / 1000, (left % 1000) * 1000};
+    struct redisContext *redis = (left > 0) ? redisConnectWithTimeout(rhost, rport, tv) : redisConnect(rhost, rport);
     if (redis                                                 // connected
         && !redis->err                                        // not error
         && (!(rauth && rauth[0]) || redis_auth(redis, rauth)) // auth
@@ -735,11 +1992,11 @@ static int redis_select(struct redisContext *redis, int base)
  * @param format
  * @param ...
  **/
-static redisReply *redis_command(redis_dataspace *dataspace, char *format, ...)
+static redisReply *redis_command(redis_link *link, char *format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    redisReply *reply = redis_vcommand(dataspace, format, ap);
+    redisReply *reply = redis_vcommand(link, format, ap);
     va_end(ap);
 
     return reply;
@@ -752,38 +2009,68 @@ static redisReply *redis_command(redis_dataspace *dataspace, char *format, ...)
  * @param format
  * @param ap
  **/
-static redisReply *redis_vcommand(redis_dataspace *dataspace, char *format, va_list ap)
+static redisReply *redis_vcommand(redis_link *link, char *format, va_list ap)
 {
-    // redisContext *cx = dataspace->context;
+    // redisContext *cx = link->context;
+
+    long long left = redis_deadline_left();
+    if (0 == left)
+    {
+        errno = ETIMEDOUT;
+        return NULL;
+    }
+
+    // the connection belongs to the I/O thread
+    if (link->pipeline)
+    {
+        return redis_pipeline_command(link, format, ap);
+    }
+
+    // replies of no-reply writes come first
+    redis_deadline_arm(link, left);
+    redis_drain(link);
 
     // on first/lost connection
-    if (!dataspace->context)
+    if (!link->context)
     {
-        dataspace->context = redis_connect(_redis_server_.host, _redis_server_.port, _redis_server_.auth, _redis_server_.timeout, dataspace->base);
+        link->context = redis_link_connect(link);
     }
+    redis_deadline_arm(link, redis_deadline_left());
 
     /** Lock redis **/
     // pthread_mutex_lock(&redis_mutex);
     // try
     redisReply *reply = NULL;
-    if (dataspace->context)
+    if (link->context)
     {
         va_list ap0;
         va_copy(ap0, ap);
-        reply = redisvCommand(dataspace->context, format, ap0);
-        syslog(LOG_DEBUG, "COMMAND (%s) = %d('%s')", format, reply->type, reply->str);
+        reply = redisvCommand(link->context, format, ap0);
+        syslog(LOG_DEBUG, "COMMAND (%s) = %d('%s')", format, reply ? reply->type : -1, reply ? reply->str : "");
         va_end(ap0);
     }
 
     // retry after reconnect
-    if ((NULL == reply) && (dataspace->context = redis_connect(_redis_server_.host, _redis_server_.port, _redis_server_.auth, _redis_server_.timeout, dataspace->base)))
+    if (NULL == reply)
+    {
+        redis_reset(link);
+
+        // no time left for the second try
+        left = redis_deadline_left();
+        if ((left >= 0) && (left < REDIS_DEADLINE_RETRY))
+        {
+            errno = ETIMEDOUT;
+            return NULL;
+        }
+    }
+    if ((NULL == reply) && (link->context = redis_link_connect(link)))
     {
         syslog(LOG_DEBUG, "SECOND try");
 
         va_list ap1;
         va_copy(ap1, ap);
 
-        reply = redisvCommand(dataspace->context, format, ap1);
+        reply = redisvCommand(link->context, format, ap1);
         va_end(ap1);
     }
     // pthread_mutex_unlock(&redis_mutex);
@@ -791,3 +2078,4304 @@ static redisReply *redis_vcommand(redis_dataspace *dataspace, char *format, va_l
 
     return reply;
 }
+
+/**
+ * Writes the formatted commands as one pipeline and reads their replies.
+ * The reply of the first command is returned, the failed others are logged.
+ * Nothing is resent, the commands need not be idempotent.
+ *
+ * @param link without auto-pipelining
+ * @param commands
+ * @param lengths
+ * @param count
+ * @return redisReply* | NULL
+ */
+static redisReply *redis_formatted(redis_link *link, char **commands, int *lengths, int count)
+{
+    redisReply **replies = calloc(count, sizeof(redisReply *));
+    if (!replies || !redis_pipelined(link, commands, lengths, count, replies))
+    {
+        FREE_AND_NULL(replies);
+        return NULL;
+    }
+
+    redisReply *first = replies[0];
+    for (int i = 1; i < count; i++)
+    {
+        if (replies[i] && (REDIS_REPLY_ERROR == replies[i]->type))
+        {
+            syslog(LOG_WARNING, "COMMANDS reply: '%s'", replies[i]->str);
+        }
+        FREE_REPLY(replies[i]);
+    }
+    free(replies);
+    return first;
+}
+
+/**
+ * Writes the formatted commands as one pipeline and reads all their replies.
+ * Nothing is resent, the commands need not be idempotent.
+ *
+ * @param link without auto-pipelining
+ * @param commands
+ * @param lengths
+ * @param count
+ * @param replies count slots, the replies are freed by the caller
+ * @return int 1 | 0 the connection failed
+ */
+static int redis_pipelined(redis_link *link, char **commands, int *lengths, int count, redisReply **replies)
+{
+    return redis_pipelined_send(link, commands, lengths, count) && redis_pipelined_read(link, count, replies);
+}
+
+/**
+ * Writes the formatted commands to the socket without reading their replies,
+ * so the pipelines of several servers run at the same time
+ *
+ * @param link without auto-pipelining
+ * @param commands
+ * @param lengths
+ * @param count
+ * @return int 1 | 0 the connection failed
+ */
+static int redis_pipelined_send(redis_link *link, char **commands, int *lengths, int count)
+{
+    long long left = redis_deadline_left();
+    if (0 == left)
+    {
+        errno = ETIMEDOUT;
+        return 0;
+    }
+    redis_deadline_arm(link, left);
+    redis_drain(link);
+    if (!link->context)
+    {
+        link->context = redis_link_connect(link);
+    }
+    if (!link->context)
+    {
+        return 0;
+    }
+    redis_deadline_arm(link, redis_deadline_left());
+
+    for (int i = 0; i < count; i++)
+    {
+        if (REDIS_OK != redisAppendFormattedCommand(link->context, commands[i], lengths[i]))
+        {
+            redis_reset(link);
+            return 0;
+        }
+    }
+    int done = 0;
+    while (!done)
+    {
+        if (REDIS_OK != redisBufferWrite(link->context, &done))
+        {
+            syslog(LOG_ERR, "COMMANDS error: %s", link->context->errstr);
+            redis_reset(link);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Reads the replies of the commands sent by redis_pipelined_send()
+ *
+ * @param link
+ * @param count
+ * @param replies count slots, the replies are freed by the caller
+ * @return int 1 | 0 the connection failed
+ */
+static int redis_pipelined_read(redis_link *link, int count, redisReply **replies)
+{
+    for (int i = 0; i < count; i++)
+    {
+        replies[i] = NULL;
+        if (REDIS_OK != redisGetReply(link->context, (void **)&replies[i]))
+        {
+            syslog(LOG_ERR, "COMMANDS error: %s", link->context->errstr);
+            redis_reset(link);
+            while (i-- > 0)
+            {
+                FREE_REPLY(replies[i]);
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Runs two formatted reads in one round trip, through the I/O thread
+ * with auto-pipelining, retried once after a lost connection
+ *
+ * @param link
+ * @param commands 2 formatted commands, freed here
+ * @param lengths
+ * @param replies 2 slots, the replies are freed by the caller
+ * @return int 1 | 0
+ */
+static int redis_read_pair(redis_link *link, char **commands, int *lengths, redisReply **replies)
+{
+    int formatted = (lengths[0] > 0) && (lengths[1] > 0);
+    int ok = 0;
+    for (int attempt = 0; formatted && !ok && (attempt < 2) && (0 != redis_deadline_left()); attempt++)
+    {
+        if (link->pipeline)
+        {
+            char *chunk = malloc(lengths[0] + lengths[1]);
+            if (chunk)
+            {
+                memcpy(chunk, commands[0], lengths[0]);
+                memcpy(chunk + lengths[0], commands[1], lengths[1]);
+            }
+            ok = chunk && redis_pipeline_chunk(link, chunk, lengths[0] + lengths[1], 2, replies);
+        }
+        else
+        {
+            ok = redis_pipelined(link, commands, lengths, 2, replies);
+        }
+    }
+    if (!ok)
+    {
+        replies[0] = replies[1] = NULL;
+    }
+    FREE_AND_NULL(commands[0]);
+    FREE_AND_NULL(commands[1]);
+    return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// deadlines
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// monotonic milliseconds of the calling thread's deadline, 0 = none
+static __thread int64_t _redis_deadline_ = 0;
+
+/**
+ * Sets the deadline of the following calls of this thread.
+ * Socket timeouts are set from the remaining budget,
+ * the reconnect and retry are skipped when less than REDIS_DEADLINE_RETRY ms is left,
+ * expired calls fail with errno = ETIMEDOUT.
+ *
+ * @param budget milliseconds from now, 0 = no deadline
+ */
+void redisDS_deadline(long long budget)
+{
+    _redis_deadline_ = (budget > 0) ? redis_now() + budget : 0;
+}
+
+static int64_t redis_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Returns the remaining budget of the calling thread
+ *
+ * @return long long milliseconds | 0 expired | -1 no deadline
+ */
+static long long redis_deadline_left()
+{
+    if (!_redis_deadline_)
+    {
+        return -1;
+    }
+    int64_t left = _redis_deadline_ - redis_now();
+    return left > 0 ? left : 0;
+}
+
+/**
+ * Sets the socket timeouts of the link from the remaining budget
+ * or clears them when there is no deadline
+ *
+ * @param link
+ * @param left milliseconds | -1
+ */
+static void redis_deadline_arm(redis_link *link, long long left)
+{
+    if (!link->context)
+    {
+        return;
+    }
+    if (left > 0)
+    {
+        struct timeval tv = {left / 1000, (left % 1000) * 1000};
+        redisSetTimeout(link->context, tv);
+        link->armed = 1;
+    }
+    else if (link->armed)
+    {
+        struct timeval tv = {0, 0};
+        redisSetTimeout(link->context, tv);
+        link->armed = 0;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// servers
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Creates an unconnected link of the dataspace to the server
+ *
+ * @param dataspace
+ * @param server index
+ * @return redis_link*
+ */
+static redis_link *redis_link_create(redis_dataspace *dataspace, int server)
+{
+    redis_link *link = malloc(sizeof(redis_link));
+    if (link)
+    {
+        link->dataspace = dataspace;
+        link->server = server;
+        link->context = NULL;
+        link->pending = 0;
+        link->armed = 0;
+        link->pipeline = NULL;
+        link->spare = NULL;
+        link->stale = 0;
+    }
+    return link;
+}
+
+/**
+ * Stops the I/O thread, drains and closes the link
+ *
+ * @param link
+ * @return redis_link* NULL
+ */
+static redis_link *redis_link_free(redis_link *link)
+{
+    if (link)
+    {
+        redis_pipeline_stop(link);
+        redis_drain(link);
+        link->context = redis_disconnect(link->context);
+        link->spare = redis_disconnect(link->spare);
+        free(link);
+    }
+    return NULL;
+}
+
+/**
+ * Connects the link to its server
+ *
+ * @param link
+ * @return struct redisContext* | NULL
+ */
+static struct redisContext *redis_link_connect(redis_link *link)
+{
+    redis_server *server = &_redis_servers_[link->server];
+    // the connect timeout of a deadline stays on the socket
+    link->armed = (redis_deadline_left() > 0);
+    return redis_connect(server->host, server->port, server->auth, server->timeout, link->dataspace->base);
+}
+
+/**
+ * FNV-1a with the murmur3 finalizer, the plain FNV clusters on similar keys
+ *
+ * @param string
+ * @return uint32_t
+ */
+static uint32_t redis_ring_hash(const char *string)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *ptr = (const unsigned char *)string; *ptr; ptr++)
+    {
+        hash = (hash ^ *ptr) * 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/**
+ * Orders the ring points by hash, the points of colliding hashes by server index,
+ * so every process builds the same ring whatever the qsort order
+ *
+ * @param a
+ * @param b
+ * @return int
+ */
+static int redis_ring_compare(const void *a, const void *b)
+{
+    const redis_point *pa = a;
+    const redis_point *pb = b;
+    if (pa->hash != pb->hash)
+    {
+        return (pa->hash > pb->hash) - (pa->hash < pb->hash);
+    }
+    return (pa->server > pb->server) - (pa->server < pb->server);
+}
+
+/**
+ * Rebuilds the ring: REDIS_RING_POINTS * weight points per server,
+ * a point depends on the server address only,
+ * so the points of the other servers keep their places
+ *
+ * @return int 1 | 0
+ */
+static int redis_ring_build()
+{
+    size_t size = 0;
+    for (int i = 0; i < _redis_server_count; i++)
+    {
+        size += (size_t)REDIS_RING_POINTS * _redis_servers_[i].weight;
+    }
+
+    redis_point *ring = malloc(size * sizeof(redis_point));
+    if (!ring)
+    {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < _redis_server_count; i++)
+    {
+        for (int j = 0; j < REDIS_RING_POINTS * _redis_servers_[i].weight; j++)
+        {
+            char point[256];
+            snprintf(point, sizeof(point), "%s:%d-%d", _redis_servers_[i].host, _redis_servers_[i].port, j);
+            ring[count].hash = redis_ring_hash(point);
+            ring[count].server = i;
+            count++;
+        }
+    }
+    qsort(ring, count, sizeof(redis_point), redis_ring_compare);
+
+    FREE_AND_NULL(_redis_ring_);
+    _redis_ring_ = ring;
+    _redis_ring_size = count;
+    return 1;
+}
+
+/**
+ * Finds the link of the server owning the full key
+ *
+ * @param dataspace
+ * @param key with prefix
+ * @return redis_link*
+ */
+static redis_link *redis_route(redis_dataspace *dataspace, char *key)
+{
+    if (dataspace->pinned >= 0)
+    {
+        return dataspace->links[dataspace->pinned];
+    }
+    return dataspace->links[redis_ring_server(key)];
+}
+
+/**
+ * Finds the server owning the full key:
+ * the first ring point clockwise from the key hash
+ *
+ * @param key with prefix
+ * @return int server index
+ */
+static int redis_ring_server(char *key)
+{
+    if (_redis_server_count < 2)
+    {
+        return 0;
+    }
+
+    uint32_t hash = redis_ring_hash(key);
+    size_t low = 0;
+    size_t high = _redis_ring_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (_redis_ring_[mid].hash < hash)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return _redis_ring_[low < _redis_ring_size ? low : 0].server;
+}
+
+/**
+ * Part of a batch routed to one server
+ */
+typedef struct redis_batch
+{
+    redis_link *link;
+    char **commands;
+    int *lengths;
+    int count;
+    long long keys;
+    int sent;
+} redis_batch;
+
+static int redis_batch_add(redis_batch *batch, int length)
+{
+    if (length <= 0)
+    {
+        batch->commands[batch->count] = NULL;
+        return 0;
+    }
+    batch->lengths[batch->count++] = length;
+    return 1;
+}
+
+/**
+ * Formats the commands writing the element like redisDS_write() does,
+ * SADD/HSET keep the TTL of an existing key by EXPIRE NX
+ *
+ * @param batch
+ * @param fullkey
+ * @param element
+ * @param ttl
+ * @return int 1 | 0
+ */
+static int redis_batch_format(redis_batch *batch, char *fullkey, cJSON *element, long long ttl)
+{
+    cJSON *item = NULL;
+    int ok = 1;
+    switch (element->type)
+    {
+    case cJSON_String:
+        ok = redis_batch_add(batch, redisFormatCommand(&batch->commands[batch->count], "SET %s %s", fullkey, element->valuestring));
+        break;
+    case cJSON_Array:
+        cJSON_ArrayForEach(item, element)
+        {
+            ok = redis_batch_add(batch, redisFormatCommand(&batch->commands[batch->count], "SADD %s %s", fullkey, item->valuestring)) && ok;
+        }
+        break;
+    case cJSON_Object:
+        cJSON_ArrayForEach(item, element)
+        {
+            ok = redis_batch_add(batch, redisFormatCommand(&batch->commands[batch->count], "HSET %s %s %s", fullkey, item->string, item->valuestring)) && ok;
+        }
+        break;
+    default:
+        return 1;
+    }
+    if (ok && (ttl > 0))
+    {
+        ok = redis_batch_add(batch, redisFormatCommand(&batch->commands[batch->count], "EXPIRE %s %lld NX", fullkey, ttl));
+    }
+    batch->keys += ok;
+    return ok;
+}
+
+/**
+ * Writes the elements of the object split by server.
+ * Every part is one pipeline, all of them are sent before the replies are read,
+ * so the servers work at the same time without a thread per part.
+ *
+ * @param dataspace
+ * @param object
+ * @param ttl
+ * @return long long written keys
+ */
+static long long redis_batch_write(redis_dataspace *dataspace, cJSON *object, long long ttl)
+{
+    int size = cJSON_GetArraySize(object) + 1;
+    redis_batch *batches = calloc(_redis_server_count, sizeof(redis_batch));
+    int *owners = malloc(size * sizeof(int));
+    int *sizes = calloc(_redis_server_count, sizeof(int));
+    if (!batches || !owners || !sizes)
+    {
+        FREE_AND_NULL(batches);
+        FREE_AND_NULL(owners);
+        FREE_AND_NULL(sizes);
+        errno = ENOMEM;
+        return 0;
+    }
+
+    // one command per member or field and the EXPIRE
+    int index = 0;
+    cJSON *element = NULL;
+    cJSON_ArrayForEach(element, object)
+    {
+        char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", element->string);
+        owners[index] = fullkey ? redis_route(dataspace, fullkey)->server : -1;
+        if (owners[index] >= 0)
+        {
+            sizes[owners[index]] += cJSON_IsString(element) ? 2 : cJSON_GetArraySize(element) + 1;
+        }
+        index++;
+        FREE_AND_NULL(fullkey);
+    }
+    size = 1;
+    for (int i = 0; i < _redis_server_count; i++)
+    {
+        size += sizes[i];
+    }
+    char **commands = calloc(size, sizeof(char *));
+    int *lengths = calloc(size, sizeof(int));
+    if (!commands || !lengths)
+    {
+        errno = ENOMEM;
+    }
+
+    // the commands grouped by server
+    int offset = 0;
+    for (int i = 0; commands && lengths && (i < _redis_server_count); i++)
+    {
+        batches[i].link = dataspace->links[i];
+        batches[i].commands = commands + offset;
+        batches[i].lengths = lengths + offset;
+        offset += sizes[i];
+    }
+    index = 0;
+    cJSON_ArrayForEach(element, object)
+    {
+        char *fullkey = (commands && lengths && owners[index] >= 0) ? aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", element->string) : NULL;
+        if (fullkey)
+        {
+            redis_cache_drop(dataspace, fullkey);
+            redis_batch_format(&batches[owners[index]], fullkey, element, ttl);
+        }
+        index++;
+        FREE_AND_NULL(fullkey);
+    }
+    free(owners);
+    free(sizes);
+
+    long long count = 0;
+    for (int i = 0; i < _redis_server_count; i++)
+    {
+        redis_batch *batch = &batches[i];
+        if (!batch->count)
+        {
+            continue;
+        }
+        if (batch->link->pipeline)
+        {
+            // the I/O thread of the link pipelines the queued commands
+            int ok = 1;
+            for (int j = 0; j < batch->count; j++)
+            {
+                ok = redis_pipeline_formatted(batch->link, batch->commands[j], batch->lengths[j]) && ok;
+                batch->commands[j] = NULL;
+            }
+            count += ok ? batch->keys : 0;
+        }
+        else
+        {
+            batch->sent = redis_pipelined_send(batch->link, batch->commands, batch->lengths, batch->count);
+        }
+    }
+
+    redisReply **replies = calloc(offset + 1, sizeof(redisReply *));
+    for (int i = 0; i < _redis_server_count; i++)
+    {
+        redis_batch *batch = &batches[i];
+        if (batch->sent && replies && redis_pipelined_read(batch->link, batch->count, replies))
+        {
+            count += batch->keys;
+            for (int j = 0; j < batch->count; j++)
+            {
+                FREE_REPLY(replies[j]);
+            }
+        }
+    }
+    free(replies);
+
+    for (int i = 0; commands && (i < offset); i++)
+    {
+        FREE_AND_NULL(commands[i]);
+    }
+    free(commands);
+    free(lengths);
+    free(batches);
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// no-reply writes
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Drops the connection, the pending replies are counted as failed
+ *
+ * @param link
+ */
+static void redis_reset(redis_link *link)
+{
+    __atomic_add_fetch(&link->dataspace->failed, link->pending, __ATOMIC_RELAXED);
+    link->pending = 0;
+    link->context = redis_disconnect(link->context);
+}
+
+/**
+ * Appends the command to the output buffer without waiting for the reply
+ *
+ * @param link
+ * @param format
+ * @param ap
+ * @return 1 | 0
+ */
+static int redis_vappend(redis_link *link, char *format, va_list ap)
+{
+    if (!link->context)
+    {
+        link->context = redis_link_connect(link);
+    }
+
+    int ret = 0;
+    if (link->context)
+    {
+        ret = (REDIS_OK == redisvAppendCommand(link->context, format, ap));
+        if (ret)
+        {
+            link->pending++;
+        }
+    }
+    return ret;
+}
+
+static int redis_append(redis_link *link, char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    int ret = redis_vappend(link, format, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+/**
+ * Writes the output buffer to the socket.
+ * Above REDIS_PENDING_MAX unread replies they are drained,
+ * so a write-only caller does not fill the client output buffer of the server.
+ *
+ * @param link
+ * @return 1 | 0
+ */
+static int redis_flush(redis_link *link)
+{
+    int done = 0;
+    while (link->context && !done)
+    {
+        if (REDIS_ERR == redisBufferWrite(link->context, &done))
+        {
+            syslog(LOG_ERR, "FLUSH error: %s", link->context->errstr);
+            redis_reset(link);
+        }
+    }
+    if (done && (link->pending >= REDIS_PENDING_MAX))
+    {
+        redis_drain(link);
+    }
+    return done;
+}
+
+/**
+ * Sends the write command followed by the expiration of the key
+ * without waiting for the replies.
+ * EXPIRE NX keeps the existing TTL like redis_expire() does,
+ * it is not sent for ttl <= 0 which would delete the key (and the whole bucket).
+ *
+ * @param link
+ * @param key
+ * @param ttl
+ * @param format
+ * @param ...
+ * @return 1 | 0
+ */
+static int redis_send(redis_link *link, char *key, long long ttl, char *format, ...)
+{
+    if (link->pipeline)
+    {
+        va_list ap;
+        va_start(ap, format);
+        int ret = redis_pipeline_vsend(link, format, ap);
+        va_end(ap);
+
+        return ret && ((ttl <= 0) || redis_pipeline_send(link, "EXPIRE %s %lld NX", key, ttl));
+    }
+
+    va_list ap;
+    va_start(ap, format);
+    int ret = redis_vappend(link, format, ap);
+    va_end(ap);
+
+    return ret && ((ttl <= 0) || redis_append(link, "EXPIRE %s %lld NX", key, ttl)) && redis_flush(link);
+}
+
+/**
+ * Reads and discards the replies of the no-reply commands
+ *
+ * @param link
+ * @return 1 | 0 some commands failed since the last sync
+ */
+static int redis_drain(redis_link *link)
+{
+    if (link->pipeline)
+    {
+        // the queue is ordered, so its replies are read once PING is answered
+        redisReply *reply = redis_command(link, "PING");
+        FREE_REPLY(reply);
+        return !__atomic_load_n(&link->dataspace->failed, __ATOMIC_ACQUIRE);
+    }
+
+    while (link->pending > 0 && link->context)
+    {
+        redisReply *reply = NULL;
+        if (REDIS_OK != redisGetReply(link->context, (void **)&reply))
+        {
+            syslog(LOG_ERR, "DRAIN error: %s", link->context->errstr);
+            redis_reset(link);
+            break;
+        }
+        if (redis_reply_failed(reply))
+        {
+            syslog(LOG_WARNING, "DRAIN reply: '%s'", reply && reply->str ? reply->str : "EXEC");
+            __atomic_add_fetch(&link->dataspace->failed, 1, __ATOMIC_RELAXED);
+        }
+        FREE_REPLY(reply);
+        link->pending--;
+    }
+    return !__atomic_load_n(&link->dataspace->failed, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Waits for the replies of the no-reply writes
+ * of the dataspace or, without a name, of all dataspaces
+ *
+ * @param name
+ * @return int 1 | 0 some writes failed since the last sync
+ */
+int redisDS_sync(char *name)
+{
+    int ret = 1;
+    int found = 0;
+    for (redis_dataspace *ptr = _redis_ds_list; ptr; ptr = ptr->next)
+    {
+        if (!name || !strcmp(name, ptr->name))
+        {
+            found = 1;
+            for (int i = 0; i < _redis_server_count; i++)
+            {
+                if (!redis_drain(ptr->links[i]))
+                {
+                    ret = 0;
+                }
+            }
+            __atomic_store_n(&ptr->failed, 0, __ATOMIC_RELEASE);
+            redis_sliding_sync(ptr->sliding);
+        }
+    }
+    if (!found)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    if (!ret)
+    {
+        errno = EIO;
+    }
+    return ret;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// auto-pipelining
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// request of the calling thread, it waits for one reply at a time
+static __thread redis_request _redis_request_;
+static __thread int _redis_request_ready = 0;
+
+/**
+ * Pushes the request to the MPSC queue, safe for many producers
+ *
+ * @param pipeline
+ * @param request
+ */
+static void redis_queue_push(redis_pipeline *pipeline, redis_request *request)
+{
+    __atomic_store_n(&request->next, NULL, __ATOMIC_RELAXED);
+    redis_request *prev = __atomic_exchange_n(&pipeline->head, request, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, request, __ATOMIC_RELEASE);
+}
+
+/**
+ * Pops the request from the MPSC queue, the I/O thread only
+ *
+ * @param pipeline
+ * @return redis_request* | NULL when empty or a push is in progress
+ */
+static redis_request *redis_queue_pop(redis_pipeline *pipeline)
+{
+    redis_request *tail = pipeline->tail;
+    redis_request *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &pipeline->stub)
+    {
+        if (!next)
+        {
+            return NULL;
+        }
+        pipeline->tail = tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next)
+    {
+        pipeline->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&pipeline->head, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    redis_queue_push(pipeline, &pipeline->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next)
+    {
+        pipeline->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * Hands the reply over to the waiting caller
+ * or discards it for a detached request
+ *
+ * @param link
+ * @param request
+ * @param reply
+ */
+static void redis_request_done(redis_link *link, redis_request *request, redisReply *reply)
+{
+    request->reply = reply;
+    if (request->detached)
+    {
+        int failed = redis_reply_failed(reply);
+        for (int i = 0; i < request->count - 1; i++)
+        {
+            failed = redis_reply_failed(request->replies[i]) || failed;
+        }
+        if (failed)
+        {
+            syslog(LOG_WARNING, "PIPELINE reply: '%s'", reply && reply->str ? reply->str : "lost");
+            __atomic_add_fetch(&link->dataspace->failed, 1, __ATOMIC_RELAXED);
+        }
+        redis_request_free(request);
+    }
+    else if (__atomic_exchange_n(&request->claimed, 1, __ATOMIC_ACQ_REL))
+    {
+        // the caller is gone, the request is ours
+        sem_destroy(&request->done);
+        redis_request_free(request);
+    }
+    else
+    {
+        sem_post(&request->done);
+    }
+}
+
+/**
+ * Frees the request with its command and replies
+ *
+ * @param request heap allocated
+ */
+static void redis_request_free(redis_request *request)
+{
+    for (int i = 0; request->replies && (i < request->count - 1); i++)
+    {
+        FREE_REPLY(request->replies[i]);
+    }
+    FREE_AND_NULL(request->replies);
+    FREE_REPLY(request->reply);
+    FREE_AND_NULL(request->command);
+    free(request);
+}
+
+/**
+ * Tells whether the reply is lost or an error, also inside the array of EXEC
+ *
+ * @param reply
+ * @return int 1 | 0
+ */
+static int redis_reply_failed(redisReply *reply)
+{
+    if (!reply || (REDIS_REPLY_ERROR == reply->type))
+    {
+        return 1;
+    }
+    for (size_t i = 0; (REDIS_REPLY_ARRAY == reply->type) && (i < reply->elements); i++)
+    {
+        if (reply->element[i] && (REDIS_REPLY_ERROR == reply->element[i]->type))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Tells whether the command only reads, so it may run twice
+ *
+ * @param format of the command
+ * @return int 1 | 0
+ */
+static int redis_idempotent(const char *format)
+{
+    static const char *reads[] = {"PING", "TYPE", "GET", "HGET", "HGETALL", "LRANGE", "LLEN", "SMEMBERS", "SCARD", "PFCOUNT", "TTL", "PTTL"};
+    size_t length = strcspn(format, " ");
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++)
+    {
+        if ((strlen(reads[i]) == length) && !strncmp(reads[i], format, length))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes the batch as one pipeline and reads the replies in order.
+ * The unanswered reads are resent once after reconnect, the unanswered writes fail:
+ * the server may have executed them before their replies were lost.
+ *
+ * @param link
+ * @param batch
+ * @param count
+ */
+static void redis_pipeline_flush(redis_link *link, redis_request **batch, int count)
+{
+    int done = 0;
+    for (int attempt = 0; attempt < 2 && done < count; attempt++)
+    {
+        if (attempt)
+        {
+            int kept = done;
+            for (int i = done; i < count; i++)
+            {
+                if (batch[i]->resend)
+                {
+                    batch[kept++] = batch[i];
+                }
+                else
+                {
+                    redis_request_done(link, batch[i], NULL);
+                }
+            }
+            count = kept;
+        }
+        if (done == count)
+        {
+            break;
+        }
+        if (!link->context)
+        {
+            link->context = redis_link_connect(link);
+        }
+        if (!link->context)
+        {
+            break;
+        }
+
+        for (int i = done; i < count; i++)
+        {
+            redisAppendFormattedCommand(link->context, batch[i]->command, batch[i]->length);
+        }
+        for (; done < count; done++)
+        {
+            // a chunk has one reply per command, the last one completes it
+            redisReply *reply = NULL;
+            int ok = 1;
+            for (int i = 0; ok && (i < batch[done]->count); i++)
+            {
+                reply = NULL;
+                ok = (REDIS_OK == redisGetReply(link->context, (void **)&reply));
+                if (ok && (i < batch[done]->count - 1))
+                {
+                    batch[done]->replies[i] = reply;
+                }
+            }
+            if (!ok)
+            {
+                syslog(LOG_ERR, "PIPELINE error: %s", link->context->errstr);
+                link->context = redis_disconnect(link->context);
+                break;
+            }
+            redis_request_done(link, batch[done], reply);
+        }
+    }
+    for (; done < count; done++)
+    {
+        redis_request_done(link, batch[done], NULL);
+    }
+}
+
+/**
+ * I/O thread: collects the queued commands and flushes them as one pipeline
+ *
+ * @param arg link
+ * @return void*
+ */
+static void *redis_pipeline_thread(void *arg)
+{
+    redis_link *link = arg;
+    redis_pipeline *pipeline = link->pipeline;
+    redis_request *batch[REDIS_PIPELINE_BATCH];
+
+    for (;;)
+    {
+        int count = 0;
+        redis_request *request = NULL;
+        while (count < REDIS_PIPELINE_BATCH && (request = redis_queue_pop(pipeline)))
+        {
+            batch[count++] = request;
+        }
+
+        if (count)
+        {
+            redis_pipeline_flush(link, batch, count);
+        }
+        else if (__atomic_load_n(&pipeline->stop, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        else
+        {
+            sem_wait(&pipeline->wakeup);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Starts the I/O thread, it owns the link connection from now on
+ *
+ * @param link
+ * @return int 1 | 0
+ */
+static int redis_pipeline_start(redis_link *link)
+{
+    if (link->pipeline)
+    {
+        return 1;
+    }
+
+    redis_pipeline *pipeline = malloc(sizeof(redis_pipeline));
+    if (pipeline)
+    {
+        pipeline->stub.next = NULL;
+        pipeline->head = &pipeline->stub;
+        pipeline->tail = &pipeline->stub;
+        pipeline->stop = 0;
+        sem_init(&pipeline->wakeup, 0, 0);
+
+        redis_drain(link);
+        link->pipeline = pipeline;
+        if (!pthread_create(&pipeline->thread, NULL, redis_pipeline_thread, link))
+        {
+            return 1;
+        }
+        link->pipeline = NULL;
+        sem_destroy(&pipeline->wakeup);
+        free(pipeline);
+    }
+    errno = ENOMEM;
+    return 0;
+}
+
+/**
+ * Stops the I/O thread after the queued commands are done
+ *
+ * @param link
+ */
+static void redis_pipeline_stop(redis_link *link)
+{
+    redis_pipeline *pipeline = link->pipeline;
+    if (pipeline)
+    {
+        __atomic_store_n(&pipeline->stop, 1, __ATOMIC_RELEASE);
+        sem_post(&pipeline->wakeup);
+        pthread_join(pipeline->thread, NULL);
+
+        link->pipeline = NULL;
+        sem_destroy(&pipeline->wakeup);
+        free(pipeline);
+    }
+}
+
+/**
+ * Queues the request and wakes up the I/O thread
+ *
+ * @param pipeline
+ * @param request
+ * @param format
+ * @param ap
+ * @return int 1 | 0
+ */
+static int redis_pipeline_post(redis_pipeline *pipeline, redis_request *request, char *format, va_list ap)
+{
+    request->resend = redis_idempotent(format);
+    request->count = 1;
+    request->replies = NULL;
+    request->command = NULL;
+    request->length = redisvFormatCommand(&request->command, format, ap);
+    if (request->length < 0)
+    {
+        return 0;
+    }
+
+    request->reply = NULL;
+    redis_queue_push(pipeline, request);
+    sem_post(&pipeline->wakeup);
+    return 1;
+}
+
+/**
+ * Queues the formatted command without waiting for the reply,
+ * the command is freed by the I/O thread or here on failure
+ *
+ * @param link
+ * @param command
+ * @param length
+ * @return int 1 | 0
+ */
+static int redis_pipeline_formatted(redis_link *link, char *command, int length)
+{
+    redis_request *request = malloc(sizeof(redis_request));
+    if (!request)
+    {
+        FREE_AND_NULL(command);
+        return 0;
+    }
+    request->detached = 1;
+    request->resend = 0;
+    request->count = 1;
+    request->replies = NULL;
+    request->command = command;
+    request->length = length;
+    request->reply = NULL;
+    redis_queue_push(link->pipeline, request);
+    sem_post(&link->pipeline->wakeup);
+    return 1;
+}
+
+/**
+ * Queues the concatenated commands as one request, so no other command
+ * runs between them, and waits for their replies until the deadline.
+ * Without the replies the request is detached like redis_pipeline_formatted().
+ * The command is freed by the I/O thread or here on failure.
+ *
+ * @param link
+ * @param command formatted commands one after the other
+ * @param length
+ * @param count commands
+ * @param replies count slots, the replies are freed by the caller | NULL
+ * @return int 1 | 0 the connection failed or the deadline passed
+ */
+static int redis_pipeline_chunk(redis_link *link, char *command, int length, int count, redisReply **replies)
+{
+    long long left = redis_deadline_left();
+    redis_request *request = (0 != left) ? calloc(1, sizeof(redis_request)) : NULL;
+    if (request && (count > 1))
+    {
+        request->replies = calloc(count - 1, sizeof(redisReply *));
+    }
+    if (!request || ((count > 1) && !request->replies))
+    {
+        errno = request ? ENOMEM : ETIMEDOUT;
+        FREE_AND_NULL(request);
+        FREE_AND_NULL(command);
+        return 0;
+    }
+    request->detached = !replies;
+    request->count = count;
+    request->command = command;
+    request->length = length;
+    if (replies)
+    {
+        sem_init(&request->done, 0, 0);
+    }
+    redis_queue_push(link->pipeline, request);
+    sem_post(&link->pipeline->wakeup);
+    if (!replies)
+    {
+        return 1;
+    }
+
+    if (!redis_request_wait(request, left))
+    {
+        syslog(LOG_WARNING, "PIPELINE chunk of %d commands timed out", count);
+        errno = ETIMEDOUT;
+        return 0;
+    }
+    int ok = (NULL != request->reply);
+    for (int i = 0; i < count - 1; i++)
+    {
+        replies[i] = ok ? request->replies[i] : NULL;
+        request->replies[i] = ok ? NULL : request->replies[i];
+    }
+    replies[count - 1] = request->reply;
+    request->reply = NULL;
+    sem_destroy(&request->done);
+    redis_request_free(request);
+    return ok;
+}
+
+/**
+ * Executes the command through the I/O thread and waits for the reply
+ *
+ * @param link
+ * @param format
+ * @param ap
+ * @return redisReply*
+ */
+static redisReply *redis_pipeline_command(redis_link *link, char *format, va_list ap)
+{
+    long long left = redis_deadline_left();
+    if (left > 0)
+    {
+        return redis_pipeline_timed(link, format, ap, left);
+    }
+
+    redis_request *request = &_redis_request_;
+    if (!_redis_request_ready)
+    {
+        sem_init(&request->done, 0, 0);
+        _redis_request_ready = 1;
+    }
+    request->detached = 0;
+    request->claimed = 0;
+
+    va_list ap0;
+    va_copy(ap0, ap);
+    int posted = redis_pipeline_post(link->pipeline, request, format, ap0);
+    va_end(ap0);
+
+    redisReply *reply = NULL;
+    if (posted)
+    {
+        while (sem_wait(&request->done) && EINTR == errno)
+        {
+        }
+        reply = request->reply;
+        FREE_AND_NULL(request->command);
+    }
+    syslog(LOG_DEBUG, "PIPELINE (%s) = %d('%s')", format, reply ? reply->type : -1, reply ? reply->str : "");
+    return reply;
+}
+
+/**
+ * Executes the command through the I/O thread and waits for the reply
+ * until the deadline, the late reply is freed by the I/O thread
+ *
+ * @param link
+ * @param format
+ * @param ap
+ * @param left milliseconds
+ * @return redisReply* | NULL with errno = ETIMEDOUT
+ */
+static redisReply *redis_pipeline_timed(redis_link *link, char *format, va_list ap, long long left)
+{
+    redis_request *request = malloc(sizeof(redis_request));
+    if (!request)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    request->detached = 0;
+    request->claimed = 0;
+    sem_init(&request->done, 0, 0);
+
+    va_list ap0;
+    va_copy(ap0, ap);
+    int posted = redis_pipeline_post(link->pipeline, request, format, ap0);
+    va_end(ap0);
+    if (!posted)
+    {
+        sem_destroy(&request->done);
+        free(request);
+        return NULL;
+    }
+
+    if (!redis_request_wait(request, left))
+    {
+        syslog(LOG_WARNING, "PIPELINE (%s) timed out", format);
+        errno = ETIMEDOUT;
+        return NULL;
+    }
+
+    redisReply *reply = request->reply;
+    FREE_AND_NULL(request->command);
+    sem_destroy(&request->done);
+    free(request);
+    return reply;
+}
+
+/**
+ * Waits for the reply of the heap allocated request until the deadline
+ *
+ * @param request
+ * @param left milliseconds, < 0 without a deadline
+ * @return int 1 the reply came | 0 timed out, the I/O thread frees the request
+ */
+static int redis_request_wait(redis_request *request, long long left)
+{
+    int ret = 0;
+    if (left > 0)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += left / 1000;
+        ts.tv_nsec += (left % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        while ((ret = sem_timedwait(&request->done, &ts)) && EINTR == errno)
+        {
+        }
+    }
+    if (ret && !__atomic_exchange_n(&request->claimed, 1, __ATOMIC_ACQ_REL))
+    {
+        return 0;
+    }
+    // the reply has come or is just coming
+    while ((left <= 0 || ret) && sem_wait(&request->done) && EINTR == errno)
+    {
+    }
+    return 1;
+}
+
+/**
+ * Queues the command without waiting for the reply
+ *
+ * @param link
+ * @param format
+ * @param ap
+ * @return int 1 | 0
+ */
+static int redis_pipeline_vsend(redis_link *link, char *format, va_list ap)
+{
+    redis_request *request = malloc(sizeof(redis_request));
+    if (request)
+    {
+        request->detached = 1;
+        if (redis_pipeline_post(link->pipeline, request, format, ap))
+        {
+            return 1;
+        }
+        free(request);
+    }
+    return 0;
+}
+
+static int redis_pipeline_send(redis_link *link, char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    int ret = redis_pipeline_vsend(link, format, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// shared read cache
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Opens the read cache shared by all processes of the host.
+ * The segment is created on first use and sized once,
+ * dataspaces use it after redisDS_option(name, REDIS_DS_CACHE, ttl).
+ *
+ * @param name shared memory object name, like "/redisds"
+ * @param size segment size in bytes
+ * @return int 1 | 0
+ */
+int redisDS_cacheOpen(char *name, size_t size)
+{
+    if (_redis_cache_.header || !name || size < sizeof(redis_cache_header) + REDIS_CACHE_PROBE * sizeof(redis_cache_slot))
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    // the existing segment keeps its size
+    struct stat st;
+    if (fstat(fd, &st) || (!st.st_size && ftruncate(fd, size)) || fstat(fd, &st))
+    {
+        close(fd);
+        return 0;
+    }
+    size = st.st_size;
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        return 0;
+    }
+
+    redis_cache_header *header = map;
+    uint64_t magic = 0;
+    if (!__atomic_compare_exchange_n(&header->magic, &magic, REDIS_CACHE_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && REDIS_CACHE_MAGIC != magic)
+    {
+        munmap(map, size);
+        errno = EINVAL;
+        return 0;
+    }
+
+    // power of two slots for the mask
+    size_t slots = 1;
+    while (slots * 2 <= (size - sizeof(redis_cache_header)) / sizeof(redis_cache_slot))
+    {
+        slots *= 2;
+    }
+
+    _redis_cache_.header = header;
+    _redis_cache_.slots = (redis_cache_slot *)(header + 1);
+    _redis_cache_.mask = slots - 1;
+    _redis_cache_.size = size;
+    return 1;
+}
+
+/**
+ * Unmaps the shared read cache, the segment itself stays for other processes
+ *
+ */
+void redisDS_cacheClose()
+{
+    if (_redis_cache_.header)
+    {
+        munmap(_redis_cache_.header, _redis_cache_.size);
+    }
+    memset(&_redis_cache_, 0, sizeof(_redis_cache_));
+}
+
+/**
+ * FNV-1a of the base and the full key, never 0
+ *
+ * @param base
+ * @param key
+ * @return uint64_t
+ */
+static uint64_t redis_cache_hash(int base, char *key)
+{
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t)base;
+    for (unsigned char *ptr = (unsigned char *)key; *ptr; ptr++)
+    {
+        hash = (hash ^ *ptr) * 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/**
+ * Serializes the result tree into the buffer:
+ * 's' string | 'n' double | 'a' count strings | 'o' count (field, string) pairs
+ *
+ * @param json
+ * @param buffer
+ * @param size
+ * @return size_t length | 0 does not fit
+ */
+static size_t redis_cache_pack(cJSON *json, char *buffer, size_t size)
+{
+    size_t length = 0;
+
+#define REDIS_CACHE_PUT(src, len)               \
+    if (length + (len) > size)                  \
+    {                                           \
+        return 0;                               \
+    }                                           \
+    memcpy(buffer + length, (src), (len));      \
+    length += (len)
+
+    if (cJSON_IsString(json))
+    {
+        REDIS_CACHE_PUT("s", 1);
+        REDIS_CACHE_PUT(json->valuestring, strlen(json->valuestring) + 1);
+    }
+    else if (cJSON_IsNumber(json))
+    {
+        REDIS_CACHE_PUT("n", 1);
+        REDIS_CACHE_PUT(&json->valuedouble, sizeof(double));
+    }
+    else if (cJSON_IsArray(json) || cJSON_IsObject(json))
+    {
+        uint32_t count = cJSON_GetArraySize(json);
+        REDIS_CACHE_PUT(cJSON_IsArray(json) ? "a" : "o", 1);
+        REDIS_CACHE_PUT(&count, sizeof(count));
+
+        cJSON *element = NULL;
+        cJSON_ArrayForEach(element, json)
+        {
+            if (!cJSON_IsString(element))
+            {
+                return 0;
+            }
+            if (cJSON_IsObject(json))
+            {
+                REDIS_CACHE_PUT(element->string, strlen(element->string) + 1);
+            }
+            REDIS_CACHE_PUT(element->valuestring, strlen(element->valuestring) + 1);
+        }
+    }
+#undef REDIS_CACHE_PUT
+
+    return length;
+}
+
+/**
+ * Takes the next string of the packed value
+ *
+ * @param buffer
+ * @param length
+ * @param offset
+ * @return char* | NULL
+ */
+static char *redis_cache_string(char *buffer, size_t length, size_t *offset)
+{
+    char *string = buffer + *offset;
+    char *end = *offset < length ? memchr(string, 0, length - *offset) : NULL;
+    if (end)
+    {
+        *offset += end - string + 1;
+        return string;
+    }
+    return NULL;
+}
+
+/**
+ * Rebuilds the result tree from the packed value
+ *
+ * @param buffer
+ * @param length
+ * @param arena
+ * @return cJSON*
+ */
+static cJSON *redis_cache_unpack(char *buffer, size_t length, redis_arena *arena)
+{
+    cJSON *json = NULL;
+    size_t offset = 1;
+
+    if (length < 1)
+    {
+        return NULL;
+    }
+    switch (buffer[0])
+    {
+    case 's':
+    {
+        char *string = redis_cache_string(buffer, length, &offset);
+        json = string ? redis_json_string(arena, string) : NULL;
+        break;
+    }
+    case 'n':
+        if (length >= 1 + sizeof(double))
+        {
+            double number;
+            memcpy(&number, buffer + 1, sizeof(double));
+            json = redis_json_number(arena, number);
+        }
+        break;
+    case 'a':
+    case 'o':
+        if (length >= 1 + sizeof(uint32_t))
+        {
+            int object = ('o' == buffer[0]);
+            uint32_t count;
+            memcpy(&count, buffer + 1, sizeof(count));
+            offset += sizeof(count);
+
+            json = redis_json_container(arena, object ? cJSON_Object : cJSON_Array);
+            for (uint32_t i = 0; json && i < count; i++)
+            {
+                char *field = object ? redis_cache_string(buffer, length, &offset) : NULL;
+                char *value = redis_cache_string(buffer, length, &offset);
+                if ((object && !field) || !value)
+                {
+                    break;
+                }
+                redis_json_add(arena, json, field, redis_json_string(arena, value));
+            }
+        }
+        break;
+    }
+    return json;
+}
+
+/**
+ * Locks the slot for writing, the odd sequence carries the writer pid and makes readers retry.
+ * A slot left locked by a writer that died is taken over and its entry is dropped
+ *
+ * @param slot
+ * @return uint32_t sequence to unlock with | 0 busy
+ */
+static uint32_t redis_cache_lock(redis_cache_slot *slot)
+{
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) && !(kill((pid_t)(seq >> 1), 0) && ESRCH == errno))
+    {
+        return 0;
+    }
+    if (!__atomic_compare_exchange_n(&slot->seq, &seq, (uint32_t)getpid() << 1 | 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    if (seq & 1)
+    {
+        syslog(LOG_WARNING, "[redisDS] cache slot recovered from dead writer %u", seq >> 1);
+        slot->expire = 0;
+        slot->keylen = 0;
+        slot->size = 0;
+        seq = (uint32_t)redis_now() << 1;
+    }
+    return (seq + 2) ? seq + 2 : 2;
+}
+
+static void redis_cache_unlock(redis_cache_slot *slot, uint32_t seq)
+{
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+}
+
+/**
+ * Reads a consistent copy of the slot
+ *
+ * @param slot
+ * @param copy
+ * @return int 1 | 0 the slot is being written
+ */
+static int redis_cache_load(redis_cache_slot *slot, redis_cache_slot *copy)
+{
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            if (attempt == 2 && (seq = redis_cache_lock(slot)))
+            {
+                redis_cache_unlock(slot, seq);
+            }
+            continue;
+        }
+        memcpy(copy, slot, offsetof(redis_cache_slot, data));
+        if (copy->size > sizeof(copy->data) || copy->keylen > copy->size)
+        {
+            copy->size = 0;
+            copy->keylen = 0;
+        }
+        memcpy(copy->data, slot->data, copy->size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Finds the slot of the key on the probe sequence
+ *
+ * @param hash
+ * @param key
+ * @param keylen
+ * @param copy consistent copy of the found slot
+ * @return redis_cache_slot* | NULL
+ */
+static redis_cache_slot *redis_cache_find(uint64_t hash, char *key, size_t keylen, redis_cache_slot *copy)
+{
+    for (size_t i = 0; i < REDIS_CACHE_PROBE; i++)
+    {
+        redis_cache_slot *slot = &_redis_cache_.slots[(hash + i) & _redis_cache_.mask];
+        uint64_t slothash = __atomic_load_n(&slot->hash, __ATOMIC_RELAXED);
+        if (!slothash)
+        {
+            return NULL;
+        }
+        if (slothash == hash && redis_cache_load(slot, copy) && copy->hash == hash && copy->keylen == keylen && !memcmp(copy->data, key, keylen))
+        {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Gets the cached value of the key
+ *
+ * @param dataspace
+ * @param key full key
+ * @param arena
+ * @param plain set when the value of a bucketed dataspace is in its own key
+ * @return cJSON* | NULL
+ */
+static cJSON *redis_cache_get(redis_dataspace *dataspace, char *key, redis_arena *arena, int *plain)
+{
+    redis_cache_slot copy;
+    size_t keylen = strlen(key);
+    if (redis_cache_find(redis_cache_hash(dataspace->base, key), key, keylen, &copy) && copy.expire > redis_now())
+    {
+        *plain = copy.plain;
+        return redis_cache_unpack(copy.data + keylen, copy.size - keylen, arena);
+    }
+    return NULL;
+}
+
+/**
+ * Stores the value of the key, evicting the first slot of the probe sequence
+ * when there is no free or expired one
+ *
+ * @param dataspace
+ * @param key full key
+ * @param json
+ * @param lifetime milliseconds, at most the remaining time to live of the key
+ * @param plain
+ */
+static void redis_cache_put(redis_dataspace *dataspace, char *key, cJSON *json, int64_t lifetime, int plain)
+{
+    redis_cache_slot copy;
+    size_t keylen = strlen(key);
+    if (keylen >= sizeof(copy.data))
+    {
+        return;
+    }
+    size_t length = redis_cache_pack(json, copy.data + keylen, sizeof(copy.data) - keylen);
+    if (!length)
+    {
+        return;
+    }
+
+    uint64_t hash = redis_cache_hash(dataspace->base, key);
+    int64_t now = redis_now();
+
+    redis_cache_slot *slot = redis_cache_find(hash, key, keylen, &copy);
+    for (size_t i = 0; !slot && i < REDIS_CACHE_PROBE; i++)
+    {
+        redis_cache_slot *probe = &_redis_cache_.slots[(hash + i) & _redis_cache_.mask];
+        if (!__atomic_load_n(&probe->hash, __ATOMIC_RELAXED) || __atomic_load_n(&probe->expire, __ATOMIC_RELAXED) <= now)
+        {
+            slot = probe;
+        }
+    }
+    if (!slot)
+    {
+        slot = &_redis_cache_.slots[hash & _redis_cache_.mask];
+    }
+
+    uint32_t seq = redis_cache_lock(slot);
+    if (seq)
+    {
+        memcpy(slot->data, key, keylen);
+        memcpy(slot->data + keylen, copy.data + keylen, length);
+        slot->keylen = keylen;
+        slot->size = keylen + length;
+        slot->expire = now + lifetime;
+        slot->plain = plain;
+        __atomic_store_n(&slot->hash, hash, __ATOMIC_RELAXED);
+        redis_cache_unlock(slot, seq);
+    }
+}
+
+/**
+ * Expires the cached value of the written key
+ *
+ * @param dataspace
+ * @param key full key
+ */
+static void redis_cache_drop(redis_dataspace *dataspace, char *key)
+{
+    if (dataspace->cache && _redis_cache_.header)
+    {
+        redis_cache_slot copy;
+        redis_cache_slot *slot = redis_cache_find(redis_cache_hash(dataspace->base, key), key, strlen(key), &copy);
+        uint32_t seq = slot ? redis_cache_lock(slot) : 0;
+        if (seq)
+        {
+            slot->expire = 0;
+            redis_cache_unlock(slot, seq);
+        }
+    }
+}
+
+/**
+ * Gets how long the value read may stay cached: the cache lifetime of the dataspace,
+ * capped at the remaining time to live of the key or of its bucket
+ *
+ * @param dataspace
+ * @param pttl of the key or of its bucket, read with the value
+ * @return int64_t milliseconds | 0 the key is gone
+ */
+static int64_t redis_lifetime(redis_dataspace *dataspace, long long pttl)
+{
+    if (-2 == pttl)
+    {
+        return 0;
+    }
+    return ((pttl >= 0) && (pttl < dataspace->cache)) ? pttl : dataspace->cache;
+}
+
+/**
+ * Reads the full key through the shared cache when it is enabled
+ *
+ * @param dataspace
+ * @param key full key
+ * @param arena
+ * @param plain set when the value of a bucketed dataspace is in its own key
+ * @return cJSON*
+ */
+static cJSON *redis_fetch(redis_dataspace *dataspace, char *key, redis_arena *arena, int *plain)
+{
+    *plain = !dataspace->buckets;
+    if (!dataspace->cache || !_redis_cache_.header)
+    {
+        return dataspace->buckets ? redis_bucket_read(dataspace, key, arena, plain, NULL) : redis_read(redis_route(dataspace, key), key, arena, NULL);
+    }
+
+    // the PTTL capping the lifetime comes in the round trip of the read
+    long long pttl = -2;
+    cJSON *json = redis_cache_get(dataspace, key, arena, plain);
+    if (!json && (json = dataspace->buckets ? redis_bucket_read(dataspace, key, arena, plain, &pttl) : redis_read(redis_route(dataspace, key), key, arena, &pttl)))
+    {
+        int64_t lifetime = redis_lifetime(dataspace, pttl);
+        if (lifetime > 0)
+        {
+            redis_cache_put(dataspace, key, json, lifetime, *plain);
+        }
+    }
+    return json;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// bucketed storage
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Maps the logical key "prefix+key" to the field "key" of the hash "prefix\x1fbucket".
+ * The separator is reserved, a key containing it has no bucket,
+ * so no logical key can name a bucket.
+ *
+ * @param dataspace
+ * @param key with prefix
+ * @param field pointer into the key
+ * @return char* bucket name | NULL
+ */
+static char *redis_bucket(redis_dataspace *dataspace, char *key, char **field)
+{
+    size_t length = dataspace->prefix ? strlen(dataspace->prefix) : 0;
+    *field = key + length;
+    if (strchr(*field, REDIS_BUCKET_SEPARATOR))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return aprint("%.*s%c%llu", (int)length, key, REDIS_BUCKET_SEPARATOR, (unsigned long long)(redis_ring_hash(*field) % dataspace->buckets));
+}
+
+/**
+ * Raises the bucket TTL to the ttl, the bucket outlives all its fields
+ *
+ * @param dataspace
+ * @param link
+ * @param bucket
+ * @param ttl
+ */
+static void redis_bucket_expire(redis_dataspace *dataspace, redis_link *link, char *bucket, long long ttl)
+{
+    if (ttl <= 0)
+    {
+        return;
+    }
+    if (dataspace->noreply)
+    {
+        // NX for the new bucket is sent by redis_send()
+        if (link->pipeline)
+        {
+            redis_pipeline_send(link, "EXPIRE %s %lld GT", bucket, ttl);
+        }
+        else if (redis_append(link, "EXPIRE %s %lld GT", bucket, ttl))
+        {
+            redis_flush(link);
+        }
+        return;
+    }
+    if (redis_ttl(link, bucket) < ttl)
+    {
+        redisReply *reply = redis_command(link, "EXPIRE %s %lld", bucket, ttl);
+        FREE_REPLY(reply);
+    }
+}
+
+/**
+ * Reads the scalar from its bucket, the other types of the dataspace
+ * (sets, counters, lists) are read from their own key
+ *
+ * @param dataspace
+ * @param key with prefix
+ * @param arena
+ * @param plain set when the value was read from the key
+ * @param pttl set to the PTTL of the bucket or of the key, it comes in the round trip of the read | NULL
+ * @return cJSON*
+ */
+static cJSON *redis_bucket_read(redis_dataspace *dataspace, char *key, redis_arena *arena, int *plain, long long *pttl)
+{
+    cJSON *json = NULL;
+
+    char *field = NULL;
+    char *bucket = redis_bucket(dataspace, key, &field);
+    if (bucket)
+    {
+        redis_link *link = redis_route(dataspace, bucket);
+        redisReply *reply = NULL;
+        if (pttl)
+        {
+            char *commands[2] = {NULL, NULL};
+            int lengths[2] = {redisFormatCommand(&commands[0], "HGET %s %s", bucket, field), redisFormatCommand(&commands[1], "PTTL %s", bucket)};
+            redisReply *replies[2] = {NULL, NULL};
+            redis_read_pair(link, commands, lengths, replies);
+            reply = replies[0];
+            *pttl = REDIS_IS_INT(replies[1]) ? replies[1]->integer : -2;
+            FREE_REPLY(replies[1]);
+        }
+        else
+        {
+            reply = redis_read_command(link, "HGET %s %s", bucket, field);
+        }
+        if (REDIS_IS_STRING(reply))
+        {
+            json = redis_json_string(arena, reply->str);
+        }
+        else if (reply && (REDIS_REPLY_NIL == reply->type))
+        {
+            json = redis_read(redis_route(dataspace, key), key, arena, pttl);
+            *plain = 1;
+        }
+        FREE_REPLY(reply);
+        FREE_AND_NULL(bucket);
+    }
+    return json;
+}
+
+/**
+ * Sets the field of the key in its bucket and extends the TTL of the bucket
+ *
+ * @param dataspace
+ * @param key
+ * @param value
+ * @param ttl seconds, <= 0 keeps the TTL of the bucket
+ * @return int 1 | 0 on error
+ */
+static int redis_bucket_set(redis_dataspace *dataspace, char *key, char *value, long long ttl)
+{
+    int ok = 0;
+
+    char *field = NULL;
+    char *bucket = redis_bucket(dataspace, key, &field);
+    if (bucket)
+    {
+        redis_link *link = redis_route(dataspace, bucket);
+        if (dataspace->noreply)
+        {
+            ok = redis_send(link, bucket, ttl, "HSET %s %s %s", bucket, field, value);
+        }
+        else
+        {
+            redisReply *reply = redis_command(link, "HSET %s %s %s", bucket, field, value);
+            ok = REDIS_IS_INT(reply);
+            FREE_REPLY(reply);
+        }
+        if (ok)
+        {
+            redis_bucket_expire(dataspace, link, bucket, ttl);
+        }
+        FREE_AND_NULL(bucket);
+    }
+    return ok;
+}
+
+static long long redis_bucket_increment(redis_dataspace *dataspace, char *key, int value, long long ttl)
+{
+    long long count = 0;
+
+    char *field = NULL;
+    char *bucket = redis_bucket(dataspace, key, &field);
+    if (bucket)
+    {
+        redis_link *link = redis_route(dataspace, bucket);
+        if (dataspace->noreply)
+        {
+            if (redis_send(link, bucket, ttl, "HINCRBY %s %s %d", bucket, field, value))
+            {
+                redis_bucket_expire(dataspace, link, bucket, ttl);
+            }
+        }
+        else
+        {
+            redisReply *reply = redis_command(link, "HINCRBY %s %s %d", bucket, field, value);
+            if (REDIS_IS_INT(reply))
+            {
+                count = reply->integer;
+                redis_bucket_expire(dataspace, link, bucket, ttl);
+            }
+            FREE_REPLY(reply);
+        }
+        FREE_AND_NULL(bucket);
+    }
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// migration
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void redis_migrate_push(redis_migrate_job *job, redis_migrate_batch *batch)
+{
+    pthread_mutex_lock(&job->mutex);
+    while (job->size >= job->limit)
+    {
+        pthread_cond_wait(&job->space, &job->mutex);
+    }
+    batch->next = NULL;
+    if (job->tail)
+    {
+        job->tail->next = batch;
+    }
+    else
+    {
+        job->head = batch;
+    }
+    job->tail = batch;
+    job->size++;
+    job->progress.scanned += job->purge ? 0 : batch->count;
+    pthread_cond_signal(&job->ready);
+    pthread_mutex_unlock(&job->mutex);
+}
+
+static redis_migrate_batch *redis_migrate_pop(redis_migrate_job *job)
+{
+    pthread_mutex_lock(&job->mutex);
+    while (!job->head && !job->closed)
+    {
+        pthread_cond_wait(&job->ready, &job->mutex);
+    }
+    redis_migrate_batch *batch = job->head;
+    if (batch)
+    {
+        job->head = batch->next;
+        if (!job->head)
+        {
+            job->tail = NULL;
+        }
+        job->size--;
+        pthread_cond_signal(&job->space);
+    }
+    pthread_mutex_unlock(&job->mutex);
+    return batch;
+}
+
+static void redis_migrate_free(redis_migrate_batch *batch)
+{
+    for (int i = 0; i < batch->count; i++)
+    {
+        FREE_AND_NULL(batch->keys[i]);
+    }
+    free(batch);
+}
+
+/**
+ * Waits for the rate limit slot of the keys
+ *
+ * @param job
+ * @param count keys
+ */
+static void redis_migrate_throttle(redis_migrate_job *job, int count)
+{
+    if (job->rate <= 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&job->mutex);
+    int64_t now = redis_now();
+    int64_t slot = job->slot > now ? job->slot : now;
+    job->slot = slot + count * 1000 / job->rate;
+    pthread_mutex_unlock(&job->mutex);
+
+    if (slot > now)
+    {
+        usleep((slot - now) * 1000);
+    }
+}
+
+static struct redisContext *redis_migrate_connect(struct redisContext **contexts, int server, int base)
+{
+    if (!contexts[server])
+    {
+        redis_server *ptr = &_redis_servers_[server];
+        contexts[server] = redis_connect(ptr->host, ptr->port, ptr->auth, ptr->timeout, base);
+    }
+    return contexts[server];
+}
+
+/**
+ * Copies the keys by MIGRATE ... COPY REPLACE KEYS, the names are kept
+ *
+ * @param job
+ * @param sources connections by server
+ * @param batch
+ * @return long long moved keys
+ */
+static long long redis_migrate_keys(redis_migrate_job *job, struct redisContext **sources, redis_migrate_batch *batch)
+{
+    struct redisContext *source = redis_migrate_connect(sources, batch->server, job->source->base);
+    redis_server *target = &_redis_servers_[job->target];
+    if (!source)
+    {
+        return 0;
+    }
+
+    const char *argv[10 + REDIS_MIGRATE_BATCH];
+    size_t argvlen[10 + REDIS_MIGRATE_BATCH];
+    char port[16];
+    char base[16];
+    char timeout[16];
+    snprintf(port, sizeof(port), "%d", target->port);
+    snprintf(base, sizeof(base), "%d", job->base);
+    snprintf(timeout, sizeof(timeout), "%d", REDIS_MIGRATE_TIMEOUT);
+
+    int argc = 0;
+    const char *head[] = {"MIGRATE", target->host, port, "", base, timeout, "COPY", "REPLACE"};
+    for (size_t i = 0; i < sizeof(head) / sizeof(head[0]); i++)
+    {
+        argv[argc] = head[i];
+        argvlen[argc++] = strlen(head[i]);
+    }
+    if (target->auth && target->auth[0])
+    {
+        argv[argc] = "AUTH";
+        argvlen[argc++] = 4;
+        argv[argc] = target->auth;
+        argvlen[argc++] = strlen(target->auth);
+    }
+    argv[argc] = "KEYS";
+    argvlen[argc++] = 4;
+    for (int i = 0; i < batch->count; i++)
+    {
+        argv[argc] = batch->keys[i];
+        argvlen[argc++] = batch->lengths[i];
+    }
+
+    long long moved = 0;
+    redisReply *reply = redisCommandArgv(source, argc, argv, argvlen);
+    if (!reply)
+    {
+        sources[batch->server] = redis_disconnect(source);
+    }
+    else if (REDIS_REPLY_STATUS == reply->type)
+    {
+        // OK or NOKEY when all of them expired meanwhile
+        moved = batch->count;
+    }
+    else
+    {
+        syslog(LOG_WARNING, "MIGRATE reply: '%s'", reply->str ? reply->str : "");
+    }
+    FREE_REPLY(reply);
+    return moved;
+}
+
+/**
+ * Copies the keys by pipelined DUMP + PTTL at the source and RESTORE ... REPLACE at the targets
+ *
+ * @param job
+ * @param sources connections by server
+ * @param targets connections by server
+ * @param batch
+ * @return long long moved or expired keys
+ */
+static long long redis_migrate_restore(redis_migrate_job *job, struct redisContext **sources, struct redisContext **targets, redis_migrate_batch *batch)
+{
+    struct redisContext *source = redis_migrate_connect(sources, batch->server, job->source->base);
+    if (!source)
+    {
+        return 0;
+    }
+
+    redisReply *dumps[REDIS_MIGRATE_BATCH] = {NULL};
+    redisReply *ttls[REDIS_MIGRATE_BATCH] = {NULL};
+    for (int i = 0; i < batch->count; i++)
+    {
+        redisAppendCommand(source, "DUMP %b", batch->keys[i], batch->lengths[i]);
+        redisAppendCommand(source, "PTTL %b", batch->keys[i], batch->lengths[i]);
+    }
+    int ok = 1;
+    for (int i = 0; ok && i < batch->count; i++)
+    {
+        ok = (REDIS_OK == redisGetReply(source, (void **)&dumps[i])) &&
+             (REDIS_OK == redisGetReply(source, (void **)&ttls[i]));
+    }
+    if (!ok)
+    {
+        sources[batch->server] = redis_disconnect(source);
+    }
+
+    // RESTORE is written to all targets first, then the replies are read
+    size_t skip = job->source->prefix ? strlen(job->source->prefix) : 0;
+    int owners[REDIS_MIGRATE_BATCH];
+    for (int i = 0; ok && i < batch->count; i++)
+    {
+        owners[i] = -1;
+        if (!REDIS_IS_STRING(dumps[i]))
+        {
+            // expired meanwhile
+            continue;
+        }
+        char *key = aprint("%s%s", job->prefix ? job->prefix : "", batch->keys[i] + skip);
+        int server = (job->target >= 0) ? job->target : redis_ring_server(key);
+        struct redisContext *target = key ? redis_migrate_connect(targets, server, job->base) : NULL;
+        if (target)
+        {
+            char ttl[32];
+            snprintf(ttl, sizeof(ttl), "%lld", REDIS_IS_INT(ttls[i]) && ttls[i]->integer > 0 ? ttls[i]->integer : 0);
+            const char *argv[] = {"RESTORE", key, ttl, dumps[i]->str, "REPLACE"};
+            size_t argvlen[] = {7, strlen(key), strlen(ttl), dumps[i]->len, 7};
+            if (REDIS_OK == redisAppendCommandArgv(target, 5, argv, argvlen))
+            {
+                owners[i] = server;
+            }
+        }
+        FREE_AND_NULL(key);
+    }
+
+    long long moved = 0;
+    for (int i = 0; ok && i < batch->count; i++)
+    {
+        if (!REDIS_IS_STRING(dumps[i]))
+        {
+            // nothing to move
+            moved++;
+            continue;
+        }
+        if (owners[i] < 0 || !targets[owners[i]])
+        {
+            continue;
+        }
+        redisReply *reply = NULL;
+        if (REDIS_OK != redisGetReply(targets[owners[i]], (void **)&reply))
+        {
+            targets[owners[i]] = redis_disconnect(targets[owners[i]]);
+            continue;
+        }
+        if (REDIS_REPLY_STATUS == reply->type)
+        {
+            moved++;
+        }
+        else
+        {
+            syslog(LOG_WARNING, "RESTORE reply: '%s'", reply->str ? reply->str : "");
+        }
+        FREE_REPLY(reply);
+    }
+
+    for (int i = 0; i < batch->count; i++)
+    {
+        FREE_REPLY(dumps[i]);
+        FREE_REPLY(ttls[i]);
+    }
+    return moved;
+}
+
+/**
+ * Deletes the source keys of the batch by pipelined UNLINK,
+ * the keys of the target namespace found by the same scan are kept
+ *
+ * @param job
+ * @param sources connections by server
+ * @param batch
+ * @param lost increased by the keys whose UNLINK failed
+ * @return long long deleted keys
+ */
+static long long redis_migrate_unlink(redis_migrate_job *job, struct redisContext **sources, redis_migrate_batch *batch, long long *lost)
+{
+    struct redisContext *source = redis_migrate_connect(sources, batch->server, job->source->base);
+    if (!source)
+    {
+        *lost += batch->count;
+        return 0;
+    }
+
+    size_t length = job->prefix ? strlen(job->prefix) : 0;
+    int local = (job->base == job->source->base) && ((job->target < 0) || (job->target == batch->server));
+    int sent = 0;
+    for (int i = 0; i < batch->count; i++)
+    {
+        if (local && !strncmp(batch->keys[i], job->prefix ? job->prefix : "", length))
+        {
+            continue;
+        }
+        if (REDIS_OK == redisAppendCommand(source, "UNLINK %b", batch->keys[i], batch->lengths[i]))
+        {
+            sent++;
+        }
+        else
+        {
+            *lost += 1;
+        }
+    }
+
+    long long removed = 0;
+    for (; sent > 0; sent--)
+    {
+        redisReply *reply = NULL;
+        if (REDIS_OK != redisGetReply(source, (void **)&reply))
+        {
+            sources[batch->server] = redis_disconnect(source);
+            break;
+        }
+        if (REDIS_IS_INT(reply))
+        {
+            removed += reply->integer;
+        }
+        else
+        {
+            *lost += 1;
+        }
+        FREE_REPLY(reply);
+    }
+    *lost += sent;
+    return removed;
+}
+
+/**
+ * Worker: moves the queued batches through its own connections
+ *
+ * @param arg job
+ * @return void*
+ */
+static void *redis_migrate_thread(void *arg)
+{
+    redis_migrate_job *job = arg;
+    struct redisContext *sources[REDIS_SERVER_MAX] = {NULL};
+    struct redisContext *targets[REDIS_SERVER_MAX] = {NULL};
+
+    redis_migrate_batch *batch = NULL;
+    while ((batch = redis_migrate_pop(job)))
+    {
+        redis_migrate_throttle(job, batch->count);
+        if (job->purge)
+        {
+            long long lost = 0;
+            long long removed = redis_migrate_unlink(job, sources, batch, &lost);
+            pthread_mutex_lock(&job->mutex);
+            job->progress.removed += removed;
+            job->lost += lost;
+            pthread_mutex_unlock(&job->mutex);
+            redis_migrate_free(batch);
+            continue;
+        }
+
+        // MIGRATE to its own server would wait for itself until the timeout
+        int migrate = !job->rename && (job->target >= 0) && (job->target != batch->server);
+        long long moved = 0;
+        for (int attempt = 0; attempt < 2 && !moved; attempt++)
+        {
+            moved = migrate ? redis_migrate_keys(job, sources, batch) : redis_migrate_restore(job, sources, targets, batch);
+        }
+
+        pthread_mutex_lock(&job->mutex);
+        job->progress.moved += moved;
+        job->progress.failed += batch->count - moved;
+        pthread_mutex_unlock(&job->mutex);
+        redis_migrate_free(batch);
+    }
+
+    for (int i = 0; i < REDIS_SERVER_MAX; i++)
+    {
+        sources[i] = redis_disconnect(sources[i]);
+        targets[i] = redis_disconnect(targets[i]);
+    }
+    return NULL;
+}
+
+/**
+ * Scans the prefix at the source server and queues the keys
+ *
+ * @param job
+ * @param server
+ * @param progress
+ * @param arg
+ * @return int 1 | 0
+ */
+static int redis_migrate_scan(redis_migrate_job *job, int server, redis_migration_progress progress, void *arg)
+{
+    redis_server *ptr = &_redis_servers_[server];
+    struct redisContext *redis = redis_connect(ptr->host, ptr->port, ptr->auth, ptr->timeout, job->source->base);
+    if (!redis)
+    {
+        return 0;
+    }
+
+    char *pattern = redis_scan_pattern(job->source->prefix);
+    int ok = (NULL != pattern);
+    char cursor[32] = "0";
+    do
+    {
+        redisReply *reply = ok ? redisCommand(redis, "SCAN %s MATCH %s COUNT %d", cursor, pattern, REDIS_MIGRATE_BATCH) : NULL;
+        if (!REDIS_IS_ARRAY(reply) || (2 != reply->elements))
+        {
+            syslog(LOG_ERR, "MIGRATE scan: '%s'", reply && reply->str ? reply->str : redis->errstr);
+            FREE_REPLY(reply);
+            ok = 0;
+            break;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+        redisReply *keys = reply->element[1];
+        redis_migrate_batch *batch = NULL;
+        for (size_t i = 0; i < keys->elements; i++)
+        {
+            if (!batch && !(batch = calloc(1, sizeof(redis_migrate_batch))))
+            {
+                ok = 0;
+                break;
+            }
+            batch->server = server;
+            batch->lengths[batch->count] = keys->element[i]->len;
+            batch->keys[batch->count] = malloc(keys->element[i]->len + 1);
+            if (batch->keys[batch->count])
+            {
+                memcpy(batch->keys[batch->count], keys->element[i]->str, keys->element[i]->len + 1);
+                batch->count++;
+            }
+            if (REDIS_MIGRATE_BATCH == batch->count)
+            {
+                redis_migrate_push(job, batch);
+                batch = NULL;
+            }
+        }
+        if (batch)
+        {
+            redis_migrate_push(job, batch);
+        }
+        FREE_REPLY(reply);
+
+        if (progress)
+        {
+            redis_migration snapshot;
+            pthread_mutex_lock(&job->mutex);
+            snapshot = job->progress;
+            pthread_mutex_unlock(&job->mutex);
+            snapshot.elapsed = (redis_now() - job->start) / 1000.0;
+            snapshot.rate = snapshot.elapsed > 0 ? snapshot.moved / snapshot.elapsed : 0;
+            progress(&snapshot, arg);
+        }
+    } while (ok && strcmp(cursor, "0"));
+
+    FREE_AND_NULL(pattern);
+    redis_disconnect(redis);
+    return ok;
+}
+
+/**
+ * SCAN pattern of the keys of a prefix,
+ * glob characters of the prefix are escaped
+ *
+ * @param prefix | NULL
+ * @return char* to free | NULL
+ */
+static char *redis_scan_pattern(const char *prefix)
+{
+    prefix = prefix ? prefix : "";
+    char *pattern = malloc(2 * strlen(prefix) + 2);
+    if (pattern)
+    {
+        char *dst = pattern;
+        for (const char *src = prefix; *src; src++)
+        {
+            if (strchr("*?[]\\", *src))
+            {
+                *dst++ = '\\';
+            }
+            *dst++ = *src;
+        }
+        *dst++ = '*';
+        *dst = 0;
+    }
+    return pattern;
+}
+
+/**
+ * Registers the migrated dataspace in place of the source by an atomic store,
+ * the readers see either the old or the new registration,
+ * the old one is freed by redisDS_serverClose()
+ *
+ * @param job
+ * @return int 1 | 0
+ */
+static int redis_migrate_switch(redis_migrate_job *job)
+{
+    redis_dataspace *source = job->source;
+    redis_dataspace *dataspace = redisDS_object(source->name, job->base, job->prefix ? strdup(job->prefix) : NULL);
+    if (!dataspace)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+    dataspace->noreply = source->noreply;
+    dataspace->cache = source->cache;
+    dataspace->approximate = source->approximate;
+    dataspace->atomic = source->atomic;
+    dataspace->buckets = source->buckets;
+    dataspace->purge = source->purge;
+    dataspace->pinned = job->target;
+    for (int i = 0; i < _redis_server_count; i++)
+    {
+        if (source->links[i] && source->links[i]->pipeline)
+        {
+            for (int j = 0; j < _redis_server_count; j++)
+            {
+                redis_pipeline_start(dataspace->links[j]);
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&_redis_ds_mutex);
+    redis_dataspace **slot = &_redis_ds_list;
+    while (*slot && (*slot != source))
+    {
+        slot = &(*slot)->next;
+    }
+    if (!*slot)
+    {
+        pthread_mutex_unlock(&_redis_ds_mutex);
+        redisDS_free(dataspace);
+        errno = EINVAL;
+        return 0;
+    }
+    dataspace->next = source->next;
+    // shared with the old registration until the close, readers may still hold it
+    dataspace->hot = source->hot; // the sketches of the threads keep counting
+    dataspace->hedge = source->hedge; // the latencies stay valid for the same data
+    if (source->sliding && redis_sliding_get(dataspace))
+    {
+        dataspace->sliding->ttl = source->sliding->ttl;
+        dataspace->sliding->interval = source->sliding->interval;
+        if (source->sliding->running)
+        {
+            redis_sliding_start(dataspace->sliding);
+        }
+    }
+    __atomic_store_n(slot, dataspace, __ATOMIC_RELEASE);
+
+    source->retired = _redis_ds_retired;
+    _redis_ds_retired = source;
+    pthread_mutex_unlock(&_redis_ds_mutex);
+    return 1;
+}
+
+/**
+ * Runs the workers over the keys of the source servers
+ *
+ * @param job
+ * @param parallel workers
+ * @param progress
+ * @param arg
+ * @return int 1 | 0 a scan failed or no worker started
+ */
+static int redis_migrate_run(redis_migrate_job *job, int parallel, redis_migration_progress progress, void *arg)
+{
+    redis_dataspace *source = job->source;
+    job->closed = 0;
+
+    pthread_t *workers = calloc(parallel, sizeof(pthread_t));
+    int started = 0;
+    while (workers && started < parallel && !pthread_create(&workers[started], NULL, redis_migrate_thread, job))
+    {
+        started++;
+    }
+
+    int ok = (started > 0);
+    for (int i = 0; ok && i < _redis_server_count; i++)
+    {
+        int scanned = (source->pinned >= 0) ? (i == source->pinned) : (_redis_servers_[i].weight > 0);
+        if (scanned && !redis_migrate_scan(job, i, progress, arg))
+        {
+            ok = 0;
+        }
+    }
+
+    pthread_mutex_lock(&job->mutex);
+    job->closed = 1;
+    pthread_cond_broadcast(&job->ready);
+    pthread_mutex_unlock(&job->mutex);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    FREE_AND_NULL(workers);
+    return ok;
+}
+
+/**
+ * Copies the keys of the dataspace to another base, prefix or server
+ * and switches the registration to the copy once all keys are moved.
+ * Keys are copied by pipelined DUMP + PTTL / RESTORE REPLACE,
+ * or by MIGRATE COPY REPLACE KEYS to another server when the prefix is kept.
+ * The source keys are kept, with REDIS_DS_MIGRATE_DELETE they are deleted by UNLINK
+ * after the switch, so the keys move; a failed deletion fails the call after the switch.
+ * Writes made to the source during the copy are not carried over,
+ * the writers of the dataspace must be stopped while it runs,
+ * the readers may go on and see the source until the switch;
+ * after the switch a new run copies from the new place.
+ * The target server is resolved among the added servers before the copy starts,
+ * no server is added here.
+ *
+ * @param name
+ * @param target added server | NULL for the configured servers
+ * @param base target base
+ * @param prefix target prefix | NULL for the source prefix
+ * @param parallel workers
+ * @param rate keys per second, 0 = unlimited
+ * @param progress called after every SCAN step | NULL
+ * @param arg
+ * @return int 1 | 0
+ */
+int redisDS_migrate(char *name, redis_server *target, int base, char *prefix, int parallel, long long rate, redis_migration_progress progress, void *arg)
+{
+    redis_dataspace *source = redisDS_get(name);
+    if (!source || parallel < 1 || (target && !(target->host && target->port)))
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    redis_migrate_job job;
+    memset(&job, 0, sizeof(job));
+    job.source = source;
+    job.target = -1;
+    job.base = base;
+    job.prefix = prefix ? prefix : source->prefix;
+    job.rename = strcmp(job.prefix ? job.prefix : "", source->prefix ? source->prefix : "");
+    job.rate = rate;
+    job.start = redis_now();
+    job.limit = 2 * parallel;
+
+    if (target)
+    {
+        for (int i = 0; i < _redis_server_count; i++)
+        {
+            if (stringEQUALS(_redis_servers_[i].host, target->host) && (_redis_servers_[i].port == target->port))
+            {
+                job.target = i;
+            }
+        }
+        if (job.target < 0)
+        {
+            syslog(LOG_ERR, "MIGRATE %s: the target %s:%d is not added", name, target->host, target->port);
+            errno = EINVAL;
+            return 0;
+        }
+    }
+    if ((job.target == source->pinned) && (base == source->base) && !job.rename)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.ready, NULL);
+    pthread_cond_init(&job.space, NULL);
+
+    int ok = redis_migrate_run(&job, parallel, progress, arg);
+    int error = !ok ? ENOMEM : (job.progress.failed ? EIO : 0);
+    int switched = !error && redis_migrate_switch(&job);
+    if (switched && source->purge)
+    {
+        job.purge = 1;
+        if (!redis_migrate_run(&job, parallel, progress, arg) || job.lost)
+        {
+            error = EIO;
+        }
+    }
+
+    job.progress.elapsed = (redis_now() - job.start) / 1000.0;
+    job.progress.rate = job.progress.elapsed > 0 ? job.progress.moved / job.progress.elapsed : 0;
+    if (progress)
+    {
+        progress(&job.progress, arg);
+    }
+    syslog(LOG_INFO, "MIGRATE %s: %lld scanned, %lld moved, %lld failed, %lld removed in %.3fs",
+           name, job.progress.scanned, job.progress.moved, job.progress.failed, job.progress.removed, job.progress.elapsed);
+
+    pthread_cond_destroy(&job.space);
+    pthread_cond_destroy(&job.ready);
+    pthread_mutex_destroy(&job.mutex);
+
+    if (error)
+    {
+        errno = error;
+        return 0;
+    }
+    return switched;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// memory report
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+typedef struct redis_memory_key
+{
+    char *key;
+    char *encoding;
+    long long bytes;
+} redis_memory_key;
+
+typedef struct redis_memory
+{
+    long long keys;    // scanned
+    long long sampled; // measured
+    long long bytes;   // of the measured keys
+    long long histogram[REDIS_MEMORY_BUCKETS];
+    cJSON *encodings; // {"encoding": count}
+    redis_memory_key largest[REDIS_MEMORY_LARGEST]; // by bytes descending
+    int size;
+} redis_memory;
+
+/**
+ * Adds a measured key to the report
+ *
+ * @param memory
+ * @param key
+ * @param bytes
+ * @param encoding
+ */
+static void redis_memory_add(redis_memory *memory, redisReply *key, long long bytes, char *encoding)
+{
+    memory->sampled++;
+    memory->bytes += bytes;
+
+    int bucket = 0;
+    while ((bucket < REDIS_MEMORY_BUCKETS - 1) && (bytes > (64LL << bucket)))
+    {
+        bucket++;
+    }
+    memory->histogram[bucket]++;
+
+    cJSON *count = cJSON_GetObjectItem(memory->encodings, encoding);
+    if (count)
+    {
+        cJSON_SetNumberValue(count, count->valuedouble + 1);
+    }
+    else
+    {
+        cJSON_AddNumberToObject(memory->encodings, encoding, 1);
+    }
+
+    if ((memory->size == REDIS_MEMORY_LARGEST) && (bytes <= memory->largest[memory->size - 1].bytes))
+    {
+        return;
+    }
+    char *copy = malloc(key->len + 1);
+    char *type = strdup(encoding);
+    if (!copy || !type)
+    {
+        FREE_AND_NULL(copy);
+        FREE_AND_NULL(type);
+        return;
+    }
+    memcpy(copy, key->str, key->len + 1);
+    if (memory->size == REDIS_MEMORY_LARGEST)
+    {
+        memory->size--;
+        FREE_AND_NULL(memory->largest[memory->size].key);
+        FREE_AND_NULL(memory->largest[memory->size].encoding);
+    }
+    int i = memory->size++;
+    for (; (i > 0) && (memory->largest[i - 1].bytes < bytes); i--)
+    {
+        memory->largest[i] = memory->largest[i - 1];
+    }
+    memory->largest[i] = (redis_memory_key){copy, type, bytes};
+}
+
+/**
+ * Measures the sampled keys by pipelined MEMORY USAGE and OBJECT ENCODING
+ *
+ * @param redis
+ * @param memory
+ * @param keys sampled key replies of SCAN
+ * @param count
+ * @return int 1 | 0
+ */
+static int redis_memory_measure(struct redisContext *redis, redis_memory *memory, redisReply **keys, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if ((REDIS_OK != redisAppendCommand(redis, "MEMORY USAGE %b", keys[i]->str, keys[i]->len)) ||
+            (REDIS_OK != redisAppendCommand(redis, "OBJECT ENCODING %b", keys[i]->str, keys[i]->len)))
+        {
+            return 0;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        redisReply *usage = NULL;
+        redisReply *encoding = NULL;
+        if ((REDIS_OK != redisGetReply(redis, (void **)&usage)) ||
+            (REDIS_OK != redisGetReply(redis, (void **)&encoding)))
+        {
+            FREE_REPLY(usage);
+            return 0;
+        }
+        // keys expired meanwhile are not counted
+        if (REDIS_IS_INT(usage))
+        {
+            redis_memory_add(memory, keys[i], usage->integer,
+                             encoding && (REDIS_REPLY_STATUS == encoding->type || REDIS_IS_STRING(encoding)) ? encoding->str : "unknown");
+        }
+        FREE_REPLY(usage);
+        FREE_REPLY(encoding);
+    }
+    return 1;
+}
+
+/**
+ * Scans the keys of the dataspace on a server, one of sample keys is measured
+ *
+ * @param dataspace
+ * @param server
+ * @param sample
+ * @param memory
+ * @return int 1 | 0
+ */
+static int redis_memory_scan(redis_dataspace *dataspace, int server, long long sample, redis_memory *memory)
+{
+    redis_server *ptr = &_redis_servers_[server];
+    struct redisContext *redis = redis_connect(ptr->host, ptr->port, ptr->auth, ptr->timeout, dataspace->base);
+    if (!redis)
+    {
+        return 0;
+    }
+
+    char *pattern = redis_scan_pattern(dataspace->prefix);
+    int ok = (NULL != pattern);
+    char cursor[32] = "0";
+    do
+    {
+        redisReply *reply = ok ? redisCommand(redis, "SCAN %s MATCH %s COUNT %d", cursor, pattern, REDIS_MIGRATE_BATCH) : NULL;
+        if (!REDIS_IS_ARRAY(reply) || (2 != reply->elements))
+        {
+            syslog(LOG_ERR, "MEMORY scan: '%s'", reply && reply->str ? reply->str : redis->errstr);
+            FREE_REPLY(reply);
+            ok = 0;
+            break;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+        redisReply *keys = reply->element[1];
+        redisReply **sampled = keys->elements ? malloc(keys->elements * sizeof(redisReply *)) : NULL;
+        int count = 0;
+        for (size_t i = 0; sampled && (i < keys->elements); i++)
+        {
+            if (0 == (memory->keys++ % sample))
+            {
+                sampled[count++] = keys->element[i];
+            }
+        }
+        if (count && !redis_memory_measure(redis, memory, sampled, count))
+        {
+            syslog(LOG_ERR, "MEMORY USAGE: '%s'", redis->errstr);
+            ok = 0;
+        }
+        ok = ok && (sampled || !keys->elements);
+        FREE_AND_NULL(sampled);
+        FREE_REPLY(reply);
+    } while (ok && strcmp(cursor, "0"));
+
+    FREE_AND_NULL(pattern);
+    redis_disconnect(redis);
+    return ok;
+}
+
+/**
+ * Audits the memory used by the keys of the dataspace.
+ * The keys of the prefix are scanned on the servers of the dataspace,
+ * MEMORY USAGE and OBJECT ENCODING of one of sample keys are pipelined.
+ * The totals are extrapolated from the measured keys.
+ *
+ * @param name
+ * @param sample one of sample keys is measured, <= 1 = all
+ * @return cJSON* {"keys", "sampled", "bytes", "average", "histogram", "encodings", "largest"} | NULL
+ */
+cJSON *redisDS_memoryReport(char *name, int sample)
+{
+    redis_dataspace *dataspace = name ? redisDS_get(name) : NULL;
+    if (!dataspace)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    redis_memory memory;
+    memset(&memory, 0, sizeof(memory));
+    cJSON *json = cJSON_CreateObject();
+    memory.encodings = cJSON_CreateObject();
+    int ok = json && memory.encodings;
+    errno = ok ? EIO : ENOMEM;
+    for (int i = 0; ok && i < _redis_server_count; i++)
+    {
+        int scanned = (dataspace->pinned >= 0) ? (i == dataspace->pinned) : (_redis_servers_[i].weight > 0);
+        if (scanned && !redis_memory_scan(dataspace, i, sample > 1 ? sample : 1, &memory))
+        {
+            ok = 0;
+        }
+    }
+
+    if (ok)
+    {
+        double average = memory.sampled ? (double)memory.bytes / memory.sampled : 0;
+        cJSON_AddNumberToObject(json, "keys", memory.keys);
+        cJSON_AddNumberToObject(json, "sampled", memory.sampled);
+        cJSON_AddNumberToObject(json, "bytes", average * memory.keys);
+        cJSON_AddNumberToObject(json, "average", average);
+
+        cJSON *histogram = cJSON_AddObjectToObject(json, "histogram");
+        for (int i = 0; histogram && i < REDIS_MEMORY_BUCKETS; i++)
+        {
+            char label[32];
+            snprintf(label, sizeof(label), i < REDIS_MEMORY_BUCKETS - 1 ? "<=%lld" : ">%lld", 64LL << (i < REDIS_MEMORY_BUCKETS - 1 ? i : i - 1));
+            cJSON_AddNumberToObject(histogram, label, memory.histogram[i]);
+        }
+
+        cJSON_AddItemToObject(json, "encodings", memory.encodings);
+        memory.encodings = NULL;
+
+        cJSON *largest = cJSON_AddArrayToObject(json, "largest");
+        for (int i = 0; largest && i < memory.size; i++)
+        {
+            cJSON *item = cJSON_CreateObject();
+            if (item)
+            {
+                cJSON_AddStringToObject(item, "key", memory.largest[i].key);
+                cJSON_AddNumberToObject(item, "bytes", memory.largest[i].bytes);
+                cJSON_AddStringToObject(item, "encoding", memory.largest[i].encoding);
+                cJSON_AddItemToArray(largest, item);
+            }
+        }
+    }
+    else
+    {
+        cJSON_Delete(json);
+        json = NULL;
+    }
+
+    cJSON_Delete(memory.encodings);
+    for (int i = 0; i < memory.size; i++)
+    {
+        FREE_AND_NULL(memory.largest[i].key);
+        FREE_AND_NULL(memory.largest[i].encoding);
+    }
+    return json;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// rate limiting
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * GCRA: the key holds the theoretical arrival time of the next request in milliseconds,
+ * each allowed request moves it by window / limit, a request is allowed while it is
+ * at most a window ahead of the server time
+ * KEYS[1] key, ARGV[1] limit, ARGV[2] window in milliseconds
+ * returns {allowed, remaining, reset, retry}
+ */
+static const char *_redis_rate_script_ =
+    "if redis.replicate_commands then redis.replicate_commands() end "
+    "local limit = tonumber(ARGV[1]) "
+    "local window = tonumber(ARGV[2]) "
+    "local interval = window / limit "
+    "local time = redis.call('TIME') "
+    "local now = tonumber(time[1]) * 1000 + math.floor(tonumber(time[2]) / 1000) "
+    "local tat = tonumber(redis.call('GET', KEYS[1]) or now) or now "
+    "if tat < now then tat = now end "
+    "local next = tat + interval "
+    "local allowed = next - window "
+    "if allowed > now then "
+    "return {0, 0, math.ceil(tat - now), math.ceil(allowed - now)} "
+    "end "
+    "redis.call('SET', KEYS[1], string.format('%.3f', next), 'PX', math.ceil(next - now)) "
+    "return {1, math.floor((now - allowed) / interval), math.ceil(next - now), 0}";
+
+
+/**
+ * Loads the script to the server of the link
+ *
+ * @param link
+ * @param sha loaded digest
+ * @return int 1 | 0
+ */
+static int redis_rate_load(redis_link *link, char *sha)
+{
+    redisReply *reply = redis_command(link, "SCRIPT LOAD %s", _redis_rate_script_);
+    int ok = REDIS_IS_STRING(reply) && (reply->len < sizeof(_redis_rate_sha_));
+    if (ok)
+    {
+        pthread_mutex_lock(&_redis_rate_mutex);
+        memcpy(_redis_rate_sha_, reply->str, reply->len + 1);
+        memcpy(sha, reply->str, reply->len + 1);
+        pthread_mutex_unlock(&_redis_rate_mutex);
+    }
+    else
+    {
+        syslog(LOG_ERR, "SCRIPT LOAD: '%s'", reply && reply->str ? reply->str : "no reply");
+    }
+    FREE_REPLY(reply);
+    return ok;
+}
+
+/**
+ * Runs the script by EVALSHA, it is loaded on the first use
+ * and again when the server does not know it
+ *
+ * @param link
+ * @param key
+ * @param limit
+ * @param window
+ * @return redisReply* | NULL
+ */
+static redisReply *redis_rate_eval(redis_link *link, char *key, long long limit, long long window)
+{
+    char sha[sizeof(_redis_rate_sha_)];
+    pthread_mutex_lock(&_redis_rate_mutex);
+    memcpy(sha, _redis_rate_sha_, sizeof(sha));
+    pthread_mutex_unlock(&_redis_rate_mutex);
+    if (!sha[0] && !redis_rate_load(link, sha))
+    {
+        return NULL;
+    }
+
+    redisReply *reply = redis_command(link, "EVALSHA %s 1 %s %lld %lld", sha, key, limit, window);
+    if (reply && (REDIS_REPLY_ERROR == reply->type) && !strncmp(reply->str, "NOSCRIPT", 8))
+    {
+        FREE_REPLY(reply);
+        reply = redis_rate_load(link, sha) ? redis_command(link, "EVALSHA %s 1 %s %lld %lld", sha, key, limit, window) : NULL;
+    }
+    return reply;
+}
+
+/**
+ * Checks and counts a request of the key by an atomic limiter at the server,
+ * at most limit requests in any window of milliseconds (GCRA) in one round trip.
+ * A key denied before is denied locally until the server would allow it again.
+ *
+ * @param name
+ * @param key
+ * @param limit requests per window
+ * @param window milliseconds
+ * @param rate result | NULL
+ * @param ...
+ * @return int 1 allowed | 0 denied | -1 error
+ */
+int redisDS_rateLimit(char *name, char *key, long long limit, long long window, redis_rate *rate, ...)
+{
+    redis_dataspace *dataspace = redisDS_get(name);
+    if (!dataspace || (limit < 1) || (window < 1))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    va_list ap;
+    va_start(ap, rate);
+    char *basekey = vaprint(key, ap);
+    va_end(ap);
+    char *fullkey = aprint("%s%s", dataspace->prefix ? dataspace->prefix : "", basekey);
+    FREE_AND_NULL(basekey);
+    redis_hot_sample(dataspace, fullkey);
+
+    redis_rate result = {0, 0, 0, 0};
+    int ret = -1;
+
+    uint64_t hash = redis_cache_hash(dataspace->base, fullkey) ^ ((uint64_t)limit * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)window;
+    int64_t now = redis_now();
+    redis_rate_slot *denied = &_redis_rate_denied_[hash % REDIS_RATE_SLOTS];
+    pthread_mutex_lock(&_redis_rate_mutex);
+    if ((denied->hash == hash) && (denied->retry > now))
+    {
+        result.retry = denied->retry - now;
+        result.reset = denied->reset - now;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&_redis_rate_mutex);
+
+    if (ret)
+    {
+        redisReply *reply = redis_rate_eval(redis_route(dataspace, fullkey), fullkey, limit, window);
+        if (REDIS_IS_ARRAY(reply) && (4 == reply->elements))
+        {
+            ret = reply->element[0]->integer ? 1 : 0;
+            result.remaining = reply->element[1]->integer;
+            result.reset = reply->element[2]->integer;
+            result.retry = reply->element[3]->integer;
+            if (!ret)
+            {
+                now = redis_now();
+                pthread_mutex_lock(&_redis_rate_mutex);
+                denied->hash = hash;
+                denied->retry = now + result.retry;
+                denied->reset = now + result.reset;
+                pthread_mutex_unlock(&_redis_rate_mutex);
+            }
+        }
+        else
+        {
+            syslog(LOG_ERR, "EVALSHA %s: '%s'", fullkey, reply && reply->str ? reply->str : "no reply");
+            errno = (reply || !errno) ? EIO : errno;
+        }
+        FREE_REPLY(reply);
+    }
+    result.allowed = (1 == ret);
+    FREE_AND_NULL(fullkey);
+
+    if (rate)
+    {
+        *rate = result;
+    }
+    return ret;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// hot keys
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// sketches of the calling thread, dropped when the dataspaces are freed
+static __thread redis_hot_sketch *_redis_hot_local_ = NULL;
+static __thread unsigned _redis_hot_seen_ = 0;
+
+/**
+ * Gets the sketch of the calling thread, creates it on first use
+ *
+ * @param hot
+ * @return redis_hot_sketch* | NULL
+ */
+static redis_hot_sketch *redis_hot_sketch_get(redis_hot *hot)
+{
+    unsigned generation = __atomic_load_n(&_redis_hot_generation, __ATOMIC_ACQUIRE);
+    if (_redis_hot_seen_ != generation)
+    {
+        _redis_hot_local_ = NULL;
+        _redis_hot_seen_ = generation;
+    }
+    for (redis_hot_sketch *sketch = _redis_hot_local_; sketch; sketch = sketch->local)
+    {
+        if (sketch->hot == hot)
+        {
+            return sketch;
+        }
+    }
+
+    redis_hot_sketch *sketch = calloc(1, sizeof(redis_hot_sketch));
+    if (sketch)
+    {
+        sketch->hot = hot;
+        sketch->random = ((uint64_t)(uintptr_t)sketch ^ (uint64_t)redis_now()) | 1;
+        pthread_mutex_lock(&hot->mutex);
+        sketch->next = hot->sketches;
+        hot->sketches = sketch;
+        pthread_mutex_unlock(&hot->mutex);
+        sketch->local = _redis_hot_local_;
+        _redis_hot_local_ = sketch;
+    }
+    return sketch;
+}
+
+/**
+ * Restores the heap order from the index down
+ *
+ * @param hot
+ * @param index
+ */
+static void redis_hot_down(redis_hot *hot, int index)
+{
+    for (;;)
+    {
+        int least = index;
+        for (int child = 2 * index + 1; child <= 2 * index + 2 && child < hot->size; child++)
+        {
+            if (hot->top[child].count < hot->top[least].count)
+            {
+                least = child;
+            }
+        }
+        if (least == index)
+        {
+            return;
+        }
+        redis_hot_key swap = hot->top[index];
+        hot->top[index] = hot->top[least];
+        hot->top[least] = swap;
+        index = least;
+    }
+}
+
+/**
+ * Restores the heap order from the index up
+ *
+ * @param hot
+ * @param index
+ */
+static void redis_hot_up(redis_hot *hot, int index)
+{
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (hot->top[parent].count <= hot->top[index].count)
+        {
+            return;
+        }
+        redis_hot_key swap = hot->top[index];
+        hot->top[index] = hot->top[parent];
+        hot->top[parent] = swap;
+        index = parent;
+    }
+}
+
+/**
+ * Offers the sampled key to the top keys,
+ * it replaces the least one when the heap is full
+ *
+ * @param hot locked
+ * @param key
+ * @param hash
+ * @param count
+ */
+static void redis_hot_offer(redis_hot *hot, char *key, uint64_t hash, uint64_t count)
+{
+    for (int i = 0; i < hot->size; i++)
+    {
+        if ((hot->top[i].hash == hash) && !strcmp(hot->top[i].key, key))
+        {
+            if (count > hot->top[i].count)
+            {
+                hot->top[i].count = count;
+                redis_hot_down(hot, i);
+            }
+            return;
+        }
+    }
+    if ((hot->size == REDIS_HOT_TOP) && (count <= hot->top[0].count))
+    {
+        return;
+    }
+    char *copy = strdup(key);
+    if (!copy)
+    {
+        return;
+    }
+    if (hot->size < REDIS_HOT_TOP)
+    {
+        hot->top[hot->size] = (redis_hot_key){copy, hash, count};
+        redis_hot_up(hot, hot->size++);
+    }
+    else
+    {
+        free(hot->top[0].key);
+        hot->top[0] = (redis_hot_key){copy, hash, count};
+        redis_hot_down(hot, 0);
+    }
+}
+
+/**
+ * Counts one of about `sample` operations of the key in the sketch of the thread.
+ * The skipped operations cost a thread-local countdown.
+ *
+ * @param dataspace
+ * @param key
+ */
+static void redis_hot_sample(redis_dataspace *dataspace, char *key)
+{
+    redis_hot *hot = dataspace->hot;
+    long long sample = hot ? __atomic_load_n(&hot->sample, __ATOMIC_RELAXED) : 0;
+    if (!sample)
+    {
+        return;
+    }
+    redis_hot_sketch *sketch = redis_hot_sketch_get(hot);
+    if (!sketch || (--sketch->skip > 0))
+    {
+        return;
+    }
+    // uniform in [1, 2 * sample - 1], one of sample operations on average
+    sketch->random ^= sketch->random << 13;
+    sketch->random ^= sketch->random >> 7;
+    sketch->random ^= sketch->random << 17;
+    sketch->skip = 1 + (long long)(sketch->random % (uint64_t)(2 * sample - 1));
+
+    uint64_t hash = redis_cache_hash(0, key);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    uint32_t count = UINT32_MAX;
+    for (int i = 0; i < REDIS_HOT_DEPTH; i++)
+    {
+        // the thread is the only writer
+        uint32_t *counter = &sketch->counts[i][(h1 + i * h2) % REDIS_HOT_WIDTH];
+        uint32_t value = __atomic_load_n(counter, __ATOMIC_RELAXED) + 1;
+        __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+        count = value < count ? value : count;
+    }
+
+    // a busy heap skips the offer, a hot key is offered again soon
+    if (!pthread_mutex_trylock(&hot->mutex))
+    {
+        redis_hot_offer(hot, key, hash, count);
+        pthread_mutex_unlock(&hot->mutex);
+    }
+}
+
+/**
+ * Estimates the samples of the key in the sketches of all threads
+ *
+ * @param hot locked
+ * @param hash
+ * @return uint64_t
+ */
+static uint64_t redis_hot_estimate(redis_hot *hot, uint64_t hash)
+{
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    uint64_t count = UINT64_MAX;
+    for (int i = 0; i < REDIS_HOT_DEPTH; i++)
+    {
+        uint64_t sum = 0;
+        for (redis_hot_sketch *sketch = hot->sketches; sketch; sketch = sketch->next)
+        {
+            sum += __atomic_load_n(&sketch->counts[i][(h1 + i * h2) % REDIS_HOT_WIDTH], __ATOMIC_RELAXED);
+        }
+        count = sum < count ? sum : count;
+    }
+    return count;
+}
+
+static int redis_hot_compare(const void *a, const void *b)
+{
+    const redis_hot_key *ka = a;
+    const redis_hot_key *kb = b;
+    return ka->count < kb->count ? 1 : (ka->count > kb->count ? -1 : 0);
+}
+
+/**
+ * Frees the hot key detection of a dataspace
+ *
+ * @param hot
+ */
+static void redis_hot_free(redis_hot *hot)
+{
+    if (hot)
+    {
+        while (hot->sketches)
+        {
+            redis_hot_sketch *sketch = hot->sketches;
+            hot->sketches = sketch->next;
+            free(sketch);
+        }
+        for (int i = 0; i < hot->size; i++)
+        {
+            FREE_AND_NULL(hot->top[i].key);
+        }
+        pthread_mutex_destroy(&hot->mutex);
+        free(hot);
+    }
+}
+
+/**
+ * Gets the most used keys of the dataspace sampled since REDIS_DS_HOTKEYS was enabled.
+ * The sketches of all threads are merged, the counts are estimates of the operations
+ * scaled by the current sampling.
+ *
+ * @param name
+ * @param k keys to return
+ * @return cJSON* array of {"key", "count", "sampled"} by count descending | NULL
+ */
+cJSON *redisDS_hotKeys(char *name, int k)
+{
+    redis_dataspace *dataspace = name ? redisDS_get(name) : NULL;
+    redis_hot *hot = dataspace ? dataspace->hot : NULL;
+    if (hot && (k > 0))
+    {
+        cJSON *json = cJSON_CreateArray();
+        if (!json)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        long long sample = __atomic_load_n(&hot->sample, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&hot->mutex);
+        redis_hot_key keys[REDIS_HOT_TOP];
+        for (int i = 0; i < hot->size; i++)
+        {
+            keys[i] = hot->top[i];
+            keys[i].count = redis_hot_estimate(hot, keys[i].hash);
+        }
+        qsort(keys, hot->size, sizeof(redis_hot_key), redis_hot_compare);
+        for (int i = 0; (i < k) && (i < hot->size); i++)
+        {
+            cJSON *item = cJSON_CreateObject();
+            if (item)
+            {
+                cJSON_AddStringToObject(item, "key", keys[i].key);
+                cJSON_AddNumberToObject(item, "count", (double)keys[i].count * (sample ? sample : 1));
+                cJSON_AddNumberToObject(item, "sampled", (double)keys[i].count);
+                cJSON_AddItemToArray(json, item);
+            }
+        }
+        pthread_mutex_unlock(&hot->mutex);
+
+        return json;
+    }
+    errno = EINVAL;
+    return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// sliding expiration
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Sends EXPIRE for the queued keys as one pipeline per server
+ * over the connections of the flusher, the queues are emptied
+ *
+ * @param sliding
+ * @param queues by server
+ */
+static void redis_sliding_flush(redis_sliding *sliding, redis_sliding_queue *queues)
+{
+    long long ttl = __atomic_load_n(&sliding->ttl, __ATOMIC_RELAXED);
+    for (int server = 0; server < REDIS_SERVER_MAX; server++)
+    {
+        redis_sliding_queue *queue = &queues[server];
+        struct redisContext *redis = NULL;
+        int sent = 0;
+        for (int i = 0; (ttl > 0) && (i < queue->count); i++)
+        {
+            if ((redis || (redis = redis_migrate_connect(sliding->contexts, server, sliding->dataspace->base))) &&
+                (REDIS_OK == redisAppendCommand(redis, "EXPIRE %s %lld", queue->keys[i], ttl)))
+            {
+                sent++;
+            }
+        }
+        for (; sent > 0; sent--)
+        {
+            redisReply *reply = NULL;
+            if (REDIS_OK != redisGetReply(redis, (void **)&reply))
+            {
+                syslog(LOG_ERR, "SLIDING error: %s", redis->errstr);
+                sliding->contexts[server] = redis_disconnect(redis);
+                break;
+            }
+            FREE_REPLY(reply);
+        }
+
+        for (int i = 0; i < queue->count; i++)
+        {
+            FREE_AND_NULL(queue->keys[i]);
+        }
+        FREE_AND_NULL(queue->keys);
+        queue->count = 0;
+        queue->size = 0;
+    }
+}
+
+/**
+ * Flusher thread: sends the touched keys every REDIS_SLIDING_FLUSH milliseconds,
+ * on a full batch or on redisDS_sync()
+ *
+ * @param arg redis_sliding
+ * @return void*
+ */
+static void *redis_sliding_thread(void *arg)
+{
+    redis_sliding *sliding = arg;
+    redis_sliding_queue queues[REDIS_SERVER_MAX];
+    pthread_mutex_lock(&sliding->mutex);
+    for (int stop = 0; !stop;)
+    {
+        if (!sliding->stop && (sliding->count < REDIS_PIPELINE_BATCH) && (sliding->flushed == sliding->requested))
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += REDIS_SLIDING_FLUSH * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000;
+            ts.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&sliding->wakeup, &sliding->mutex, &ts);
+        }
+        stop = sliding->stop;
+        long long requested = sliding->requested;
+        memcpy(queues, sliding->queues, sizeof(queues));
+        memset(sliding->queues, 0, sizeof(sliding->queues));
+        sliding->count = 0;
+        pthread_mutex_unlock(&sliding->mutex);
+
+        redis_sliding_flush(sliding, queues);
+
+        pthread_mutex_lock(&sliding->mutex);
+        sliding->flushed = requested;
+        pthread_cond_broadcast(&sliding->done);
+    }
+    pthread_mutex_unlock(&sliding->mutex);
+    return NULL;
+}
+
+/**
+ * Gets the sliding expiration of the dataspace, it is created on first use
+ * without its flusher
+ *
+ * @param dataspace
+ * @return redis_sliding* | NULL
+ */
+static redis_sliding *redis_sliding_get(redis_dataspace *dataspace)
+{
+    if (!dataspace->sliding)
+    {
+        redis_sliding *sliding = calloc(1, sizeof(redis_sliding));
+        if (!sliding)
+        {
+            return NULL;
+        }
+        sliding->dataspace = dataspace;
+        sliding->interval = REDIS_SLIDING_INTERVAL;
+        pthread_mutex_init(&sliding->mutex, NULL);
+        pthread_cond_init(&sliding->wakeup, NULL);
+        pthread_cond_init(&sliding->done, NULL);
+        dataspace->sliding = sliding;
+    }
+    return dataspace->sliding;
+}
+
+/**
+ * Starts the flusher once
+ *
+ * @param sliding
+ * @return int 1 | 0
+ */
+static int redis_sliding_start(redis_sliding *sliding)
+{
+    if (!sliding->running && !pthread_create(&sliding->thread, NULL, redis_sliding_thread, sliding))
+    {
+        sliding->running = 1;
+    }
+    return sliding->running;
+}
+
+/**
+ * Records the read key for the refresh of its TTL,
+ * a key refreshed within the interval is skipped
+ *
+ * @param dataspace
+ * @param key with prefix
+ * @param plain the key of a bucketed dataspace is not in a bucket
+ */
+static void redis_sliding_touch(redis_dataspace *dataspace, char *key, int plain)
+{
+    redis_sliding *sliding = dataspace->sliding;
+    if (!sliding || (__atomic_load_n(&sliding->ttl, __ATOMIC_RELAXED) <= 0))
+    {
+        return;
+    }
+
+    // the bucket expires as a whole
+    char *field = NULL;
+    char *bucket = (dataspace->buckets && !plain) ? redis_bucket(dataspace, key, &field) : NULL;
+    key = bucket ? bucket : key;
+
+    uint64_t hash = redis_cache_hash(dataspace->base, key);
+    redis_sliding_slot *slot = &sliding->sent[hash % REDIS_SLIDING_SLOTS];
+    int64_t now = redis_now();
+    redis_sliding_queue *queue = &sliding->queues[redis_route(dataspace, key)->server];
+
+    pthread_mutex_lock(&sliding->mutex);
+    if (((slot->hash != hash) || (now - slot->time >= sliding->interval)) && (sliding->count < REDIS_SLIDING_PENDING))
+    {
+        if (queue->count == queue->size)
+        {
+            int size = queue->size ? 2 * queue->size : REDIS_PIPELINE_BATCH;
+            char **keys = realloc(queue->keys, size * sizeof(char *));
+            if (keys)
+            {
+                queue->keys = keys;
+                queue->size = size;
+            }
+        }
+        char *copy = (queue->count < queue->size) ? strdup(key) : NULL;
+        if (copy)
+        {
+            queue->keys[queue->count++] = copy;
+            sliding->count++;
+            slot->hash = hash;
+            slot->time = now;
+            if (REDIS_PIPELINE_BATCH == sliding->count)
+            {
+                pthread_cond_signal(&sliding->wakeup);
+            }
+        }
+    }
+    pthread_mutex_unlock(&sliding->mutex);
+    FREE_AND_NULL(bucket);
+}
+
+/**
+ * Waits until the keys touched so far are refreshed
+ *
+ * @param sliding
+ */
+static void redis_sliding_sync(redis_sliding *sliding)
+{
+    if (sliding && sliding->running)
+    {
+        pthread_mutex_lock(&sliding->mutex);
+        long long requested = ++sliding->requested;
+        pthread_cond_signal(&sliding->wakeup);
+        while (sliding->flushed < requested)
+        {
+            pthread_cond_wait(&sliding->done, &sliding->mutex);
+        }
+        pthread_mutex_unlock(&sliding->mutex);
+    }
+}
+
+/**
+ * Stops the flusher after its last flush and frees the sliding expiration
+ *
+ * @param sliding
+ */
+static void redis_sliding_free(redis_sliding *sliding)
+{
+    if (sliding)
+    {
+        if (sliding->running)
+        {
+            pthread_mutex_lock(&sliding->mutex);
+            sliding->stop = 1;
+            pthread_cond_signal(&sliding->wakeup);
+            pthread_mutex_unlock(&sliding->mutex);
+            pthread_join(sliding->thread, NULL);
+        }
+
+        for (int i = 0; i < REDIS_SERVER_MAX; i++)
+        {
+            sliding->contexts[i] = redis_disconnect(sliding->contexts[i]);
+        }
+        pthread_cond_destroy(&sliding->done);
+        pthread_cond_destroy(&sliding->wakeup);
+        pthread_mutex_destroy(&sliding->mutex);
+        free(sliding);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// hedged reads
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Gets the hedged reads of the dataspace, they are created on first use
+ *
+ * @param dataspace
+ * @return redis_hedge* | NULL
+ */
+static redis_hedge *redis_hedge_get(redis_dataspace *dataspace)
+{
+    if (!dataspace->hedge)
+    {
+        redis_hedge *hedge = calloc(1, sizeof(redis_hedge));
+        if (hedge)
+        {
+            hedge->rate = REDIS_HEDGE_RATE;
+            dataspace->hedge = hedge;
+        }
+    }
+    return dataspace->hedge;
+}
+
+static int64_t redis_hedge_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Returns the delay after which a read is hedged,
+ * the adaptive delay is the p95 of the recent latencies rounded up to its bin
+ *
+ * @param hedge
+ * @return long long milliseconds | 0 not hedged
+ */
+static long long redis_hedge_delay(redis_hedge *hedge)
+{
+    long long delay = __atomic_load_n(&hedge->delay, __ATOMIC_RELAXED);
+    if (delay >= 0)
+    {
+        return delay;
+    }
+
+    uint32_t bins[REDIS_HEDGE_BINS];
+    uint64_t total = 0;
+    for (int i = 0; i < REDIS_HEDGE_BINS; i++)
+    {
+        bins[i] = __atomic_load_n(&hedge->latency[i], __ATOMIC_RELAXED);
+        total += bins[i];
+    }
+    if (total < REDIS_HEDGE_WARMUP)
+    {
+        return 0;
+    }
+
+    uint64_t rank = total - total / 20;
+    uint64_t seen = 0;
+    for (int i = 0; i < REDIS_HEDGE_BINS; i++)
+    {
+        seen += bins[i];
+        if (seen >= rank)
+        {
+            return ((1LL << (i + 1)) + 999) / 1000;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Counts the read and its latency,
+ * the statistics are halved every REDIS_HEDGE_WINDOW reads to follow the load
+ *
+ * @param hedge
+ * @param latency microseconds
+ */
+static void redis_hedge_record(redis_hedge *hedge, int64_t latency)
+{
+    int bin = 0;
+    while ((bin < REDIS_HEDGE_BINS - 1) && (latency >> (bin + 1)))
+    {
+        bin++;
+    }
+    __atomic_add_fetch(&hedge->latency[bin], 1, __ATOMIC_RELAXED);
+
+    if (REDIS_HEDGE_WINDOW == __atomic_add_fetch(&hedge->reads, 1, __ATOMIC_RELAXED))
+    {
+        for (int i = 0; i < REDIS_HEDGE_BINS; i++)
+        {
+            uint32_t count = __atomic_load_n(&hedge->latency[i], __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&hedge->latency[i], count / 2, __ATOMIC_RELAXED);
+        }
+        long long hedges = __atomic_load_n(&hedge->hedges, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&hedge->hedges, hedges / 2, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&hedge->reads, REDIS_HEDGE_WINDOW / 2, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Takes a hedge when the hedged reads stay within the rate,
+ * so a slow server does not get the whole traffic twice
+ *
+ * @param hedge
+ * @return 1 | 0 over the rate
+ */
+static int redis_hedge_allow(redis_hedge *hedge)
+{
+    long long rate = __atomic_load_n(&hedge->rate, __ATOMIC_RELAXED);
+    long long reads = __atomic_load_n(&hedge->reads, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&hedge->hedges, __ATOMIC_RELAXED) * 100 >= rate * (reads + 1))
+    {
+        return 0;
+    }
+    __atomic_add_fetch(&hedge->hedges, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Writes the formatted command to the connection
+ *
+ * @param context
+ * @param command
+ * @param length
+ * @return 1 | 0
+ */
+static int redis_hedge_write(struct redisContext *context, char *command, int length)
+{
+    if (REDIS_OK != redisAppendFormattedCommand(context, command, length))
+    {
+        return 0;
+    }
+    int done = 0;
+    while (!done)
+    {
+        if (REDIS_OK != redisBufferWrite(context, &done))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Takes a parsed reply of the connection without blocking
+ *
+ * @param context
+ * @param readable the socket has data
+ * @param reply NULL when none is complete yet
+ * @return 1 | 0 the connection failed
+ */
+static int redis_hedge_read(struct redisContext *context, int readable, redisReply **reply)
+{
+    if (readable && (REDIS_OK != redisBufferRead(context)))
+    {
+        return 0;
+    }
+    return REDIS_OK == redisGetReplyFromReader(context, (void **)reply);
+}
+
+/**
+ * Takes the reply of the spare connection, the replies of the lost hedges are skipped
+ *
+ * @param link
+ * @param readable the socket has data
+ * @param reply NULL when none is complete yet
+ * @return 1 | 0 the connection failed
+ */
+static int redis_hedge_spare(redis_link *link, int readable, redisReply **reply)
+{
+    readable = readable && link->spare;
+    while (link->spare)
+    {
+        redisReply *next = NULL;
+        if (!redis_hedge_read(link->spare, readable, &next))
+        {
+            return 0;
+        }
+        readable = 0;
+        if (!next || !link->stale)
+        {
+            *reply = next;
+            return 1;
+        }
+        link->stale--;
+        FREE_REPLY(next);
+    }
+    return 0;
+}
+
+/**
+ * Sends the duplicate of the read over the spare connection
+ *
+ * @param link
+ * @param hedge
+ * @param command
+ * @param length
+ * @return 1 | 0 not hedged
+ */
+static int redis_hedge_send(redis_link *link, redis_hedge *hedge, char *command, int length)
+{
+    if (!redis_hedge_allow(hedge))
+    {
+        return 0;
+    }
+
+    // the replies of the earlier hedges that arrived meanwhile
+    if (link->spare)
+    {
+        struct pollfd fd = {link->spare->fd, POLLIN, 0};
+        redisReply *unexpected = NULL;
+        if (!redis_hedge_spare(link, poll(&fd, 1, 0) > 0, &unexpected) || unexpected || (link->stale > REDIS_HEDGE_STALE))
+        {
+            FREE_REPLY(unexpected);
+            link->spare = redis_disconnect(link->spare);
+        }
+    }
+    if (!link->spare)
+    {
+        redis_server *server = &_redis_servers_[link->server];
+        link->spare = redis_connect(server->host, server->port, server->auth, server->timeout, link->dataspace->base);
+        link->stale = 0;
+    }
+
+    if (link->spare && redis_hedge_write(link->spare, command, length))
+    {
+        return 1;
+    }
+    link->spare = redis_disconnect(link->spare);
+    return 0;
+}
+
+/**
+ * Executes the formatted read on the link, hedged after the delay.
+ * When the spare wins, the connections are swapped and the lagging reply is skipped later.
+ *
+ * @param link without auto-pipelining
+ * @param hedge
+ * @param command
+ * @param length
+ * @param delay milliseconds
+ * @param reply
+ * @return 1 replied | 0 the connection was lost | -1 the deadline expired
+ */
+static int redis_hedged(redis_link *link, redis_hedge *hedge, char *command, int length, long long delay, redisReply **reply)
+{
+    long long left = redis_deadline_left();
+    if (0 == left)
+    {
+        return -1;
+    }
+    redis_deadline_arm(link, left);
+    redis_drain(link);
+    if (!link->context)
+    {
+        link->context = redis_link_connect(link);
+    }
+    redis_deadline_arm(link, redis_deadline_left());
+    if (!link->context || !redis_hedge_write(link->context, command, length))
+    {
+        redis_reset(link);
+        return 0;
+    }
+
+    int64_t now = redis_now();
+    int64_t start = now;
+    int64_t end = (left > 0) ? now + left : 0;
+    int primary = 1; // the first connection still works
+    int hedged = 0;  // 1 = the duplicate is in flight, -1 = it is not sent
+    int ready[2] = {0, 0};
+    for (;;)
+    {
+        if (primary && !redis_hedge_read(link->context, ready[0], reply))
+        {
+            primary = 0;
+        }
+        if (*reply)
+        {
+            link->stale += (hedged > 0);
+            return 1;
+        }
+        if ((hedged > 0) && !redis_hedge_spare(link, ready[1], reply))
+        {
+            link->spare = redis_disconnect(link->spare);
+            hedged = -1;
+        }
+        if (*reply)
+        {
+            // the lagging connection becomes the spare
+            struct redisContext *lagging = link->context;
+            link->context = link->spare;
+            link->spare = primary ? lagging : redis_disconnect(lagging);
+            link->stale = primary;
+            link->armed = 1;
+            syslog(LOG_DEBUG, "HEDGE won after %lld ms", (long long)(redis_now() - start));
+            return 1;
+        }
+        if (!primary && (hedged <= 0))
+        {
+            redis_reset(link);
+            return 0;
+        }
+
+        now = redis_now();
+        if (end && (now >= end))
+        {
+            link->stale += (hedged > 0);
+            redis_reset(link);
+            return -1;
+        }
+        if (!hedged && (now >= start + delay))
+        {
+            hedged = redis_hedge_send(link, hedge, command, length) ? 1 : -1;
+            ready[0] = ready[1] = 0;
+            continue;
+        }
+
+        int64_t timeout = end ? end - now : -1;
+        if (!hedged && ((timeout < 0) || (start + delay - now < timeout)))
+        {
+            timeout = start + delay - now;
+        }
+        struct pollfd fds[2] = {
+            {primary ? link->context->fd : -1, POLLIN, 0},
+            {(hedged > 0) ? link->spare->fd : -1, POLLIN, 0},
+        };
+        int count = poll(fds, 2, (int)timeout);
+        if ((count < 0) && (EINTR != errno))
+        {
+            link->stale += (hedged > 0);
+            redis_reset(link);
+            return 0;
+        }
+        ready[0] = (count > 0) && fds[0].revents;
+        ready[1] = (count > 0) && fds[1].revents;
+    }
+}
+
+/**
+ * Executes the read command of the link.
+ * With hedging a duplicate goes over the spare connection
+ * when no reply arrived within the delay, the first reply wins.
+ *
+ * @param link
+ * @param format of an idempotent command
+ * @param ...
+ * @return redisReply*
+ */
+static redisReply *redis_read_command(redis_link *link, char *format, ...)
+{
+    redis_hedge *hedge = link->pipeline ? NULL : link->dataspace->hedge;
+    int64_t start = hedge ? redis_hedge_clock() : 0;
+    long long delay = hedge ? redis_hedge_delay(hedge) : 0;
+
+    va_list ap;
+    va_start(ap, format);
+    redisReply *reply = NULL;
+    int done = 0;
+    if (delay > 0)
+    {
+        char *command = NULL;
+        va_list ap0;
+        va_copy(ap0, ap);
+        int length = redisvFormatCommand(&command, format, ap0);
+        va_end(ap0);
+        done = (length > 0) ? redis_hedged(link, hedge, command, length, delay, &reply) : 0;
+        FREE_AND_NULL(command);
+    }
+    // the retry after the lost connection
+    if (!done)
+    {
+        reply = redis_vcommand(link, format, ap);
+    }
+    else if (done < 0)
+    {
+        errno = ETIMEDOUT;
+    }
+    va_end(ap);
+
+    if (hedge && reply)
+    {
+        redis_hedge_record(hedge, redis_hedge_clock() - start);
+    }
+    return reply;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// result arena
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static pthread_key_t _redis_arena_key;
+static pthread_once_t _redis_arena_once = PTHREAD_ONCE_INIT;
+
+static void redis_arena_init()
+{
+    pthread_key_create(&_redis_arena_key, free);
+}
+
+/**
+ * Allocates an arena block
+ *
+ * @param size data size
+ * @return redis_arena*
+ */
+static redis_arena *redis_arena_block(size_t size)
+{
+    redis_arena *block = malloc(sizeof(redis_arena) + size);
+    if (block)
+    {
+        block->magic = 0;
+        block->next = NULL;
+        block->tail = block;
+        block->size = size;
+        block->used = 0;
+    }
+    return block;
+}
+
+/**
+ * Creates an arena, reusing the block cached by the current thread
+ *
+ * @return redis_arena*
+ */
+static redis_arena *redis_arena_create()
+{
+    pthread_once(&_redis_arena_once, redis_arena_init);
+
+    redis_arena *arena = pthread_getspecific(_redis_arena_key);
+    if (arena)
+    {
+        pthread_setspecific(_redis_arena_key, NULL);
+        return arena;
+    }
+    return redis_arena_block(REDIS_ARENA_BLOCK);
+}
+
+/**
+ * Frees the overflow blocks and keeps the first one
+ * in the current thread cache
+ *
+ * @param arena
+ */
+static void redis_arena_free(redis_arena *arena)
+{
+    if (arena)
+    {
+        for (redis_arena *block = arena->next, *next = NULL; block; block = next)
+        {
+            next = block->next;
+            free(block);
+        }
+        arena->next = NULL;
+        arena->tail = arena;
+        arena->used = 0;
+
+        pthread_once(&_redis_arena_once, redis_arena_init);
+        if (pthread_getspecific(_redis_arena_key) || pthread_setspecific(_redis_arena_key, arena))
+        {
+            free(arena);
+        }
+    }
+}
+
+/**
+ * Frees the block cached by the current thread
+ *
+ */
+static void redis_arena_drop()
+{
+    pthread_once(&_redis_arena_once, redis_arena_init);
+
+    free(pthread_getspecific(_redis_arena_key));
+    pthread_setspecific(_redis_arena_key, NULL);
+}
+
+/**
+ * Allocates memory from the arena
+ *
+ * @param arena
+ * @param size
+ * @return void* | NULL
+ */
+static void *redis_arena_alloc(redis_arena *arena, size_t size)
+{
+    size = REDIS_ARENA_ALIGN(size);
+
+    redis_arena *block = arena->tail;
+    if (block->used + size > block->size)
+    {
+        block = redis_arena_block(size > REDIS_ARENA_BLOCK ? size : REDIS_ARENA_BLOCK);
+        if (!block)
+        {
+            return NULL;
+        }
+        arena->tail->next = block;
+        arena->tail = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static cJSON *redis_arena_node(redis_arena *arena, int type)
+{
+    cJSON *item = redis_arena_alloc(arena, sizeof(cJSON));
+    if (item)
+    {
+        memset(item, 0, sizeof(cJSON));
+        item->type = type;
+    }
+    return item;
+}
+
+static char *redis_arena_strdup(redis_arena *arena, const char *string)
+{
+    size_t len = strlen(string) + 1;
+    char *copy = redis_arena_alloc(arena, len);
+    return copy ? memcpy(copy, string, len) : NULL;
+}
+
+/**
+ * Creates a string node in the arena or by cJSON
+ *
+ * @param arena
+ * @param string
+ * @return cJSON*
+ */
+static cJSON *redis_json_string(redis_arena *arena, const char *string)
+{
+    if (!arena)
+    {
+        return cJSON_CreateString(string);
+    }
+
+    cJSON *item = redis_arena_node(arena, cJSON_String);
+    if (item && !(item->valuestring = redis_arena_strdup(arena, string ? string : "")))
+    {
+        return NULL;
+    }
+    return item;
+}
+
+static cJSON *redis_json_number(redis_arena *arena, double number)
+{
+    if (!arena)
+    {
+        return cJSON_CreateNumber(number);
+    }
+
+    cJSON *item = redis_arena_node(arena, cJSON_Number);
+    if (item)
+    {
+        cJSON_SetNumberHelper(item, number);
+    }
+    return item;
+}
+
+/**
+ * Creates an array or object node in the arena or by cJSON
+ *
+ * @param arena
+ * @param type cJSON_Array | cJSON_Object
+ * @return cJSON*
+ */
+static cJSON *redis_json_container(redis_arena *arena, int type)
+{
+    if (!arena)
+    {
+        return cJSON_Object == type ? cJSON_CreateObject() : cJSON_CreateArray();
+    }
+    return redis_arena_node(arena, type);
+}
+
+/**
+ * Adds the item to the array or, with a field name, to the object
+ *
+ * @param arena
+ * @param json
+ * @param field
+ * @param item
+ */
+static void redis_json_add(redis_arena *arena, cJSON *json, const char *field, cJSON *item)
+{
+    if (item)
+    {
+        if (arena)
+        {
+            // arena nodes are only linked, the tree is never freed by cJSON
+            if (field)
+            {
+                char *string = redis_arena_strdup(arena, field);
+                if (string)
+                {
+                    cJSON_AddItemToObjectCS(json, string, item);
+                }
+            }
+            else
+            {
+                cJSON_AddItemToArray(json, item);
+            }
+        }
+        else if (!(field ? cJSON_AddItemToObject(json, field, item) : cJSON_AddItemToArray(json, item)))
+        {
+            cJSON_Delete(item);
+        }
+    }
+}
@@ -27,20 +27,116 @@ typedef struct redis_server
     int port;
     char *auth;
     int timeout;
+    int weight; // share of the consistent hash ring
 } redis_server;
 
+/**
+ * Dataspace options for redisDS_option()
+ *
+ */
+typedef enum redis_option
+{
+    // value != 0: set/append/increment return as soon as the commands are written,
+    // their replies are drained by the next command or redisDS_sync() (requires Redis 7)
+    REDIS_DS_NOREPLY,
+    // value != 0: commands of all threads are queued to one I/O thread of the dataspace
+    // and written as pipelines, the calls still block until their replies
+    REDIS_DS_AUTOPIPELINE,
+    // value > 0: redisDS_read() results are kept in the shared cache of redisDS_cacheOpen()
+    // for value milliseconds but never past the key expiry, writes of this host drop the cached keys
+    REDIS_DS_CACHE,
+    // value != 0: redisDS_append() counts the members of the key approximately by a HyperLogLog
+    // (PFADD/PFCOUNT, ~0.81% error, at most 12 KB per key), redisDS_read() returns the estimate
+    REDIS_DS_APPROXIMATE,
+    // value > 0: scalars of set/increment/read are fields of value hashes "prefix\x1fbucket",
+    // the key picks its bucket by hash, so small buckets stay listpack-encoded;
+    // a bucket expires as a whole, its TTL is raised to the largest TTL written to it;
+    // keys must not contain \x1f, read falls back to the key itself for the other types
+    REDIS_DS_BUCKETS,
+    // value > 0: one of value operations of read/set/append/increment on average is counted
+    // in a count-min sketch of the calling thread, redisDS_hotKeys() merges them
+    REDIS_DS_HOTKEYS,
+    // value > 0: keys found by redisDS_read() get their TTL renewed to value seconds,
+    // a background thread sends the EXPIREs in pipelines, redisDS_sync() waits for them
+    REDIS_DS_SLIDING,
+    // value >= 0: milliseconds a key is not refreshed again after its refresh, 1000 by default
+    REDIS_DS_SLIDING_INTERVAL,
+    // value > 0: milliseconds without a reply after which a read is sent again over a second connection,
+    // the first reply wins; -1: the live p95 read latency of the dataspace; 0: off (auto-pipelined reads are not hedged)
+    REDIS_DS_HEDGE,
+    // value 0..100: percent of the reads that may be hedged, 5 by default
+    REDIS_DS_HEDGE_RATE,
+    // value != 0: every chunk of redisDS_setMany() is written inside MULTI/EXEC
+    REDIS_DS_ATOMIC,
+    // value != 0: redisDS_migrate() deletes the source keys once the registration is switched,
+    // by default the source keys are kept
+    REDIS_DS_MIGRATE_DELETE,
+} redis_option;
+
 int redisDS_serverOpen(char *host,
                        int port,
                        char *auth,
                        int timeout);
+int redisDS_serverAdd(char *host, int port, char *auth, int timeout, int weight);
 int redisDS_register(char *name, int base, char *prefix, ...);
+int redisDS_option(char *name, redis_option option, long long value);
+int redisDS_sync(char *name);
+cJSON *redisDS_hotKeys(char *name, int k);
+cJSON *redisDS_memoryReport(char *name, int sample);
+
+/**
+ * Result of redisDS_rateLimit()
+ */
+typedef struct redis_rate
+{
+    int allowed;
+    long long remaining; // requests allowed now after this one
+    long long reset;     // milliseconds until the whole limit is available
+    long long retry;     // milliseconds until the next request is allowed, 0 = now
+} redis_rate;
+
+int redisDS_rateLimit(char *name, char *key, long long limit, long long window, redis_rate *rate, ...);
+
+/**
+ * Progress of redisDS_migrate()
+ */
+typedef struct redis_migration
+{
+    long long scanned; // source keys found
+    long long moved;   // keys restored at the target
+    long long failed;  // keys not moved
+    long long removed; // source keys deleted after the switch (REDIS_DS_MIGRATE_DELETE)
+    double elapsed;    // seconds
+    double rate;       // moved keys per second
+} redis_migration;
+
+typedef void (*redis_migration_progress)(const redis_migration *migration, void *arg);
+
+// the writers of the dataspace must be stopped while it is migrated,
+// the target server must be added by redisDS_serverAdd() before (weight 0 keeps it out of the ring)
+int redisDS_migrate(char *name,
+                    redis_server *target,
+                    int base,
+                    char *prefix,
+                    int parallel,
+                    long long rate,
+                    redis_migration_progress progress,
+                    void *arg);
+void redisDS_deadline(long long budget);
 void redisDS_serverClose();
 
+int redisDS_cacheOpen(char *name, size_t size);
+void redisDS_cacheClose();
+
 cJSON *redisDS_read(char *name, char *key, ...);
+cJSON *redisDS_readArena(char *name, char *key, ...);
+void redisDS_release(cJSON *json);
 
 long long redisDS_set(char *name, char *key, char *value, long long ttl, ...);
 long long redisDS_append(char *name, char *key, char *value, long long ttl, ...);
 long long redisDS_increment(char *name, char *key, int value, long long ttl, ...);
+long long redisDS_push(char *name, char *key, cJSON *values, long long maxlen, long long ttl, ...);
+long long redisDS_setMany(char *name, char **keys, char **values, int n, long long ttl, int *status);
 
 // for testing
 long long redisDS_store(char *name, cJSON *object, long long ttl);
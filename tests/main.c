@@ -11,6 +11,7 @@
 #include <redisds/redis_ds.h>
 
 extern CU_TestInfo testing_actions[];
+extern void testing_actions_check(CU_pSuite suite);
 
 static int checkError(CU_ErrorCode error)
 {
@@ -45,6 +46,9 @@ int main(int argc, char *argv[])
         {
             return ret;
         }
+        // the tests without their server are reported as inactive, not as failed
+        CU_set_fail_on_inactive(CU_FALSE);
+        testing_actions_check(CU_get_suite("[testing_actions]"));
 
         if (argc > 1)
         {
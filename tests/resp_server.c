@@ -0,0 +1,1324 @@
+/**
+ * @brief In-process RESP server for the tests
+ **/
+#include "defines.h"
+#include "resp_server.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RESP_DATABASES 16
+#define RESP_SLOTS 1024
+#define RESP_RULES 32
+#define RESP_READ 16384
+
+typedef enum resp_type
+{
+    RESP_STRING,
+    RESP_HASH, // items are field, value pairs
+    RESP_SET,
+    RESP_LIST,
+} resp_type;
+
+typedef struct resp_entry
+{
+    char *key;
+    resp_type type;
+    char **items;
+    size_t count;
+    size_t size;
+    int64_t expire; // monotonic milliseconds, 0 = persistent
+    struct resp_entry *next;
+} resp_entry;
+
+typedef struct resp_rule
+{
+    char command[32]; // "" = any command
+    int delay;        // microseconds
+    int jitter;       // microseconds added at random
+    resp_fault fault;
+    long long every; // the fault hits every n-th command
+    long long seen;
+} resp_rule;
+
+typedef struct resp_out
+{
+    char *data;
+    size_t length;
+    size_t size;
+} resp_out;
+
+typedef struct resp_client
+{
+    struct resp_server *server;
+    int fd; // -1 = closed
+    pthread_t thread;
+    int base;
+    int authed;
+    int multi;            // inside MULTI
+    int queued;           // commands of the transaction
+    int held;             // the replies of the last read wait for their delay
+    resp_out transaction; // their replies, returned by EXEC
+    struct resp_client *next;
+} resp_client;
+
+struct resp_server
+{
+    int listener;
+    int port;
+    char *auth;
+    pthread_t thread;
+    pthread_mutex_t mutex; // keys, rules, counters and clients
+    resp_entry *slots[RESP_DATABASES][RESP_SLOTS];
+    resp_rule rules[RESP_RULES];
+    int count; // rules
+    unsigned seed;
+    long long commands;
+    long long batches; // reads with commands, i.e. round trips
+    int stopping;
+    resp_client *clients;
+};
+
+typedef void (*resp_handler)(resp_client *client, int argc, char **argv, resp_out *out);
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// replies
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void resp_write(resp_out *out, const char *data, size_t length)
+{
+    if (out->length + length > out->size)
+    {
+        size_t size = out->size ? out->size : RESP_READ;
+        while (size < out->length + length)
+        {
+            size *= 2;
+        }
+        char *ptr = realloc(out->data, size);
+        if (!ptr)
+        {
+            return;
+        }
+        out->data = ptr;
+        out->size = size;
+    }
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+static void resp_printf(resp_out *out, const char *format, ...)
+{
+    char *line = NULL;
+    va_list ap;
+    va_start(ap, format);
+    int length = vasprintf(&line, format, ap);
+    va_end(ap);
+    if (length >= 0)
+    {
+        resp_write(out, line, length);
+    }
+    FREE_AND_NULL(line);
+}
+
+static void resp_bulk(resp_out *out, const char *string)
+{
+    size_t length = strlen(string);
+    resp_printf(out, "$%zu\r\n", length);
+    resp_write(out, string, length);
+    resp_write(out, "\r\n", 2);
+}
+
+static void resp_wrongtype(resp_out *out)
+{
+    resp_printf(out, "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// keys
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static int64_t resp_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static resp_entry **resp_slot(resp_server *server, int base, char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (unsigned char *ptr = (unsigned char *)key; *ptr; ptr++)
+    {
+        hash = (hash ^ *ptr) * 16777619u;
+    }
+    return &server->slots[base][hash % RESP_SLOTS];
+}
+
+static void resp_entry_free(resp_entry *entry)
+{
+    for (size_t i = 0; i < entry->count; i++)
+    {
+        FREE_AND_NULL(entry->items[i]);
+    }
+    FREE_AND_NULL(entry->items);
+    FREE_AND_NULL(entry->key);
+    free(entry);
+}
+
+/**
+ * Unlinks and frees the key
+ *
+ * @return int 1 | 0 not found
+ */
+static int resp_remove(resp_server *server, int base, char *key)
+{
+    for (resp_entry **ptr = resp_slot(server, base, key); *ptr; ptr = &(*ptr)->next)
+    {
+        if (!strcmp((*ptr)->key, key))
+        {
+            resp_entry *entry = *ptr;
+            *ptr = entry->next;
+            resp_entry_free(entry);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Finds the key, expired keys are removed
+ *
+ * @return resp_entry* | NULL
+ */
+static resp_entry *resp_find(resp_server *server, int base, char *key)
+{
+    for (resp_entry *entry = *resp_slot(server, base, key); entry; entry = entry->next)
+    {
+        if (!strcmp(entry->key, key))
+        {
+            if (entry->expire && (entry->expire <= resp_now()))
+            {
+                resp_remove(server, base, key);
+                return NULL;
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static resp_entry *resp_create(resp_server *server, int base, char *key, resp_type type)
+{
+    resp_entry *entry = calloc(1, sizeof(resp_entry));
+    if (entry && (entry->key = strdup(key)))
+    {
+        resp_entry **slot = resp_slot(server, base, key);
+        entry->type = type;
+        entry->next = *slot;
+        *slot = entry;
+        return entry;
+    }
+    FREE_AND_NULL(entry);
+    return NULL;
+}
+
+/**
+ * Finds the key of the type or creates it
+ *
+ * @return resp_entry* | NULL with the error replied
+ */
+static resp_entry *resp_typed(resp_client *client, char *key, resp_type type, resp_out *out)
+{
+    resp_entry *entry = resp_find(client->server, client->base, key);
+    if (entry && (entry->type != type))
+    {
+        resp_wrongtype(out);
+        return NULL;
+    }
+    if (!entry && !(entry = resp_create(client->server, client->base, key, type)))
+    {
+        resp_printf(out, "-ERR out of memory\r\n");
+    }
+    return entry;
+}
+
+/**
+ * Inserts a copy of the item at the index
+ *
+ * @return int 1 | 0
+ */
+static int resp_insert(resp_entry *entry, size_t index, char *item)
+{
+    if (entry->count == entry->size)
+    {
+        size_t size = entry->size ? 2 * entry->size : 4;
+        char **items = realloc(entry->items, size * sizeof(char *));
+        if (!items)
+        {
+            return 0;
+        }
+        entry->items = items;
+        entry->size = size;
+    }
+    char *copy = strdup(item);
+    if (!copy)
+    {
+        return 0;
+    }
+    memmove(entry->items + index + 1, entry->items + index, (entry->count - index) * sizeof(char *));
+    entry->items[index] = copy;
+    entry->count++;
+    return 1;
+}
+
+/**
+ * Index of the item among every step-th items
+ *
+ * @return long | -1
+ */
+static long resp_index(resp_entry *entry, char *item, size_t step)
+{
+    for (size_t i = 0; i < entry->count; i += step)
+    {
+        if (!strcmp(entry->items[i], item))
+        {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static int resp_integer(char *string, long long *value)
+{
+    char *end = NULL;
+    errno = 0;
+    *value = strtoll(string, &end, 10);
+    return string[0] && !*end && !errno;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// commands
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void resp_ping(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)client;
+    if (argc > 1)
+    {
+        resp_bulk(out, argv[1]);
+    }
+    else
+    {
+        resp_printf(out, "+PONG\r\n");
+    }
+}
+
+static void resp_auth(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    char *password = argv[argc - 1];
+    if (!client->server->auth)
+    {
+        resp_printf(out, "-ERR AUTH <password> called without any password configured for the default user\r\n");
+    }
+    else if (!strcmp(client->server->auth, password))
+    {
+        client->authed = 1;
+        resp_printf(out, "+OK\r\n");
+    }
+    else
+    {
+        resp_printf(out, "-WRONGPASS invalid username-password pair or user is disabled.\r\n");
+    }
+}
+
+static void resp_select(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    long long base = 0;
+    if (!resp_integer(argv[1], &base) || (base < 0) || (base >= RESP_DATABASES))
+    {
+        resp_printf(out, "-ERR DB index is out of range\r\n");
+        return;
+    }
+    client->base = (int)base;
+    resp_printf(out, "+OK\r\n");
+}
+
+static void resp_type_of(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    static char *names[] = {"string", "hash", "set", "list"};
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    resp_printf(out, "+%s\r\n", entry ? names[entry->type] : "none");
+}
+
+static void resp_get(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    if (!entry)
+    {
+        resp_printf(out, "$-1\r\n");
+    }
+    else if (entry->type != RESP_STRING)
+    {
+        resp_wrongtype(out);
+    }
+    else
+    {
+        resp_bulk(out, entry->items[0]);
+    }
+}
+
+static void resp_set(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    int64_t expire = 0;
+    int nx = 0, xx = 0;
+    for (int i = 3; i < argc; i++)
+    {
+        long long value = 0;
+        if (!strcasecmp(argv[i], "NX"))
+        {
+            nx = 1;
+        }
+        else if (!strcasecmp(argv[i], "XX"))
+        {
+            xx = 1;
+        }
+        else if ((!strcasecmp(argv[i], "EX") || !strcasecmp(argv[i], "PX")) && (i + 1 < argc) &&
+                 resp_integer(argv[i + 1], &value) && (value > 0))
+        {
+            expire = resp_now() + (toupper(argv[i][0]) == 'E' ? 1000 * value : value);
+            i++;
+        }
+        else
+        {
+            resp_printf(out, "-ERR syntax error\r\n");
+            return;
+        }
+    }
+
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    if ((nx && entry) || (xx && !entry))
+    {
+        resp_printf(out, "$-1\r\n");
+        return;
+    }
+    resp_remove(client->server, client->base, argv[1]);
+    entry = resp_create(client->server, client->base, argv[1], RESP_STRING);
+    if (!entry || !resp_insert(entry, 0, argv[2]))
+    {
+        resp_printf(out, "-ERR out of memory\r\n");
+        return;
+    }
+    entry->expire = expire;
+    resp_printf(out, "+OK\r\n");
+}
+
+static void resp_mset(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    if (0 == argc % 2)
+    {
+        resp_printf(out, "-ERR wrong number of arguments for 'mset' command\r\n");
+        return;
+    }
+    for (int i = 1; i < argc; i += 2)
+    {
+        resp_remove(client->server, client->base, argv[i]);
+        resp_entry *entry = resp_create(client->server, client->base, argv[i], RESP_STRING);
+        if (!entry || !resp_insert(entry, 0, argv[i + 1]))
+        {
+            resp_printf(out, "-ERR out of memory\r\n");
+            return;
+        }
+    }
+    resp_printf(out, "+OK\r\n");
+}
+
+static void resp_del(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    long long count = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        count += resp_find(client->server, client->base, argv[i]) && resp_remove(client->server, client->base, argv[i]);
+    }
+    resp_printf(out, ":%lld\r\n", count);
+}
+
+static void resp_hset(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    if (argc % 2)
+    {
+        resp_printf(out, "-ERR wrong number of arguments for 'hset' command\r\n");
+        return;
+    }
+    resp_entry *entry = resp_typed(client, argv[1], RESP_HASH, out);
+    if (entry)
+    {
+        long long added = 0;
+        for (int i = 2; i < argc; i += 2)
+        {
+            long index = resp_index(entry, argv[i], 2);
+            if (index >= 0)
+            {
+                char *value = strdup(argv[i + 1]);
+                if (value)
+                {
+                    free(entry->items[index + 1]);
+                    entry->items[index + 1] = value;
+                }
+            }
+            else if (resp_insert(entry, entry->count, argv[i]))
+            {
+                // a field without its value is dropped
+                if (!resp_insert(entry, entry->count, argv[i + 1]))
+                {
+                    entry->count--;
+                    FREE_AND_NULL(entry->items[entry->count]);
+                    continue;
+                }
+                added++;
+            }
+        }
+        resp_printf(out, ":%lld\r\n", added);
+    }
+}
+
+/**
+ * Replies all items of the key of the type, an empty array for a missing key
+ */
+static void resp_items(resp_client *client, char *key, resp_type type, resp_out *out)
+{
+    resp_entry *entry = resp_find(client->server, client->base, key);
+    if (entry && (entry->type != type))
+    {
+        resp_wrongtype(out);
+        return;
+    }
+    resp_printf(out, "*%zu\r\n", entry ? entry->count : 0);
+    for (size_t i = 0; entry && (i < entry->count); i++)
+    {
+        resp_bulk(out, entry->items[i]);
+    }
+}
+
+static void resp_hgetall(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    resp_items(client, argv[1], RESP_HASH, out);
+}
+
+static void resp_sadd(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    resp_entry *entry = resp_typed(client, argv[1], RESP_SET, out);
+    if (entry)
+    {
+        long long added = 0;
+        for (int i = 2; i < argc; i++)
+        {
+            added += (resp_index(entry, argv[i], 1) < 0) && resp_insert(entry, entry->count, argv[i]);
+        }
+        resp_printf(out, ":%lld\r\n", added);
+    }
+}
+
+static void resp_smembers(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    resp_items(client, argv[1], RESP_SET, out);
+}
+
+static void resp_scard(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    if (entry && (entry->type != RESP_SET))
+    {
+        resp_wrongtype(out);
+        return;
+    }
+    resp_printf(out, ":%zu\r\n", entry ? entry->count : 0);
+}
+
+static void resp_push(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    resp_entry *entry = resp_typed(client, argv[1], RESP_LIST, out);
+    if (entry)
+    {
+        int left = (toupper(argv[0][0]) == 'L');
+        for (int i = 2; i < argc; i++)
+        {
+            resp_insert(entry, left ? 0 : entry->count, argv[i]);
+        }
+        resp_printf(out, ":%zu\r\n", entry->count);
+    }
+}
+
+static void resp_lrange(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    long long start = 0, stop = 0;
+    if (!resp_integer(argv[2], &start) || !resp_integer(argv[3], &stop))
+    {
+        resp_printf(out, "-ERR value is not an integer or out of range\r\n");
+        return;
+    }
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    if (entry && (entry->type != RESP_LIST))
+    {
+        resp_wrongtype(out);
+        return;
+    }
+    long long count = entry ? (long long)entry->count : 0;
+    start = start < 0 ? (start + count < 0 ? 0 : start + count) : start;
+    stop = stop < 0 ? stop + count : (stop >= count ? count - 1 : stop);
+    long long length = (start <= stop) && (start < count) ? stop - start + 1 : 0;
+    resp_printf(out, "*%lld\r\n", length);
+    for (long long i = 0; i < length; i++)
+    {
+        resp_bulk(out, entry->items[start + i]);
+    }
+}
+
+static void resp_ltrim(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    long long start = 0, stop = 0;
+    if (!resp_integer(argv[2], &start) || !resp_integer(argv[3], &stop))
+    {
+        resp_printf(out, "-ERR value is not an integer or out of range\r\n");
+        return;
+    }
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    if (entry && (entry->type != RESP_LIST))
+    {
+        resp_wrongtype(out);
+        return;
+    }
+    if (entry)
+    {
+        long long count = (long long)entry->count;
+        start = start < 0 ? (start + count < 0 ? 0 : start + count) : start;
+        stop = stop < 0 ? stop + count : (stop >= count ? count - 1 : stop);
+        if ((start > stop) || (start >= count))
+        {
+            resp_remove(client->server, client->base, argv[1]);
+        }
+        else
+        {
+            for (long long i = 0; i < count; i++)
+            {
+                if ((i < start) || (i > stop))
+                {
+                    FREE_AND_NULL(entry->items[i]);
+                }
+            }
+            memmove(entry->items, entry->items + start, (stop - start + 1) * sizeof(char *));
+            entry->count = stop - start + 1;
+        }
+    }
+    resp_printf(out, "+OK\r\n");
+}
+
+static void resp_llen(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    if (entry && (entry->type != RESP_LIST))
+    {
+        resp_wrongtype(out);
+        return;
+    }
+    resp_printf(out, ":%zu\r\n", entry ? entry->count : 0);
+}
+
+static void resp_incrby(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    long long increment = 0, value = 0;
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    if (entry && (entry->type != RESP_STRING))
+    {
+        resp_wrongtype(out);
+        return;
+    }
+    if (!resp_integer(argv[2], &increment) || (entry && !resp_integer(entry->items[0], &value)))
+    {
+        resp_printf(out, "-ERR value is not an integer or out of range\r\n");
+        return;
+    }
+    char number[32];
+    snprintf(number, sizeof(number), "%lld", value + increment);
+    if (!entry)
+    {
+        entry = resp_create(client->server, client->base, argv[1], RESP_STRING);
+        if (!entry || !resp_insert(entry, 0, number))
+        {
+            resp_printf(out, "-ERR out of memory\r\n");
+            return;
+        }
+    }
+    else
+    {
+        char *copy = strdup(number);
+        if (!copy)
+        {
+            resp_printf(out, "-ERR out of memory\r\n");
+            return;
+        }
+        free(entry->items[0]);
+        entry->items[0] = copy;
+    }
+    resp_printf(out, ":%lld\r\n", value + increment);
+}
+
+static void resp_ttl(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    long long ttl = entry ? (entry->expire ? (entry->expire - resp_now() + 500) / 1000 : -1) : -2;
+    resp_printf(out, ":%lld\r\n", ttl);
+}
+
+static void resp_expire(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    long long seconds = 0;
+    if (!resp_integer(argv[2], &seconds))
+    {
+        resp_printf(out, "-ERR value is not an integer or out of range\r\n");
+        return;
+    }
+    char *flag = argc > 3 ? argv[3] : "";
+    if (flag[0] && strcasecmp(flag, "NX") && strcasecmp(flag, "XX") && strcasecmp(flag, "GT") && strcasecmp(flag, "LT"))
+    {
+        resp_printf(out, "-ERR Unsupported option %s\r\n", flag);
+        return;
+    }
+    resp_entry *entry = resp_find(client->server, client->base, argv[1]);
+    int64_t expire = resp_now() + 1000 * seconds;
+    int set = (NULL != entry);
+    if (set && flag[0])
+    {
+        switch (toupper(flag[0]))
+        {
+        case 'N':
+            set = !entry->expire;
+            break;
+        case 'X':
+            set = (0 != entry->expire);
+            break;
+        case 'G':
+            set = entry->expire && (expire > entry->expire);
+            break;
+        default:
+            set = !entry->expire || (expire < entry->expire);
+            break;
+        }
+    }
+    if (set && (seconds <= 0))
+    {
+        resp_remove(client->server, client->base, argv[1]);
+    }
+    else if (set)
+    {
+        entry->expire = expire;
+    }
+    resp_printf(out, ":%d\r\n", set);
+}
+
+static void resp_flushdb(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    (void)argv;
+    for (int i = 0; i < RESP_SLOTS; i++)
+    {
+        while (client->server->slots[client->base][i])
+        {
+            resp_entry *entry = client->server->slots[client->base][i];
+            client->server->slots[client->base][i] = entry->next;
+            resp_entry_free(entry);
+        }
+    }
+    resp_printf(out, "+OK\r\n");
+}
+
+/**
+ * The commands of a transaction run as they are queued,
+ * EXEC returns their replies
+ */
+static void resp_multi(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    (void)argv;
+    if (client->multi)
+    {
+        resp_printf(out, "-ERR MULTI calls can not be nested\r\n");
+        return;
+    }
+    client->multi = 1;
+    client->queued = 0;
+    client->transaction.length = 0;
+    resp_printf(out, "+OK\r\n");
+}
+
+static void resp_exec(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    (void)argc;
+    (void)argv;
+    if (!client->multi)
+    {
+        resp_printf(out, "-ERR EXEC without MULTI\r\n");
+        return;
+    }
+    resp_printf(out, "*%d\r\n", client->queued);
+    if (client->transaction.length)
+    {
+        resp_write(out, client->transaction.data, client->transaction.length);
+    }
+    client->multi = 0;
+    client->transaction.length = 0;
+}
+
+// arity > 0 exact, < 0 minimum, including the command name
+static const struct
+{
+    char *name;
+    int arity;
+    resp_handler handler;
+} resp_commands[] = {
+    {"PING", -1, resp_ping},
+    {"AUTH", -2, resp_auth},
+    {"SELECT", 2, resp_select},
+    {"TYPE", 2, resp_type_of},
+    {"GET", 2, resp_get},
+    {"SET", -3, resp_set},
+    {"MSET", -3, resp_mset},
+    {"DEL", -2, resp_del},
+    {"HSET", -4, resp_hset},
+    {"HGETALL", 2, resp_hgetall},
+    {"SADD", -3, resp_sadd},
+    {"SMEMBERS", 2, resp_smembers},
+    {"SCARD", 2, resp_scard},
+    {"RPUSH", -3, resp_push},
+    {"LPUSH", -3, resp_push},
+    {"LRANGE", 4, resp_lrange},
+    {"LTRIM", 4, resp_ltrim},
+    {"LLEN", 2, resp_llen},
+    {"INCRBY", 3, resp_incrby},
+    {"TTL", 2, resp_ttl},
+    {"EXPIRE", -3, resp_expire},
+    {"FLUSHDB", -1, resp_flushdb},
+    {"MULTI", 1, resp_multi},
+    {"EXEC", 1, resp_exec},
+};
+
+static void resp_execute(resp_client *client, int argc, char **argv, resp_out *out)
+{
+    for (size_t i = 0; i < sizeof(resp_commands) / sizeof(resp_commands[0]); i++)
+    {
+        if (!strcasecmp(resp_commands[i].name, argv[0]))
+        {
+            int arity = resp_commands[i].arity;
+            if ((arity > 0) ? (argc != arity) : (argc < -arity))
+            {
+                resp_printf(out, "-ERR wrong number of arguments for '%s' command\r\n", argv[0]);
+            }
+            else if (client->server->auth && !client->authed && (resp_auth != resp_commands[i].handler))
+            {
+                resp_printf(out, "-NOAUTH Authentication required.\r\n");
+            }
+            else if (client->multi && (resp_multi != resp_commands[i].handler) && (resp_exec != resp_commands[i].handler))
+            {
+                pthread_mutex_lock(&client->server->mutex);
+                resp_commands[i].handler(client, argc, argv, &client->transaction);
+                pthread_mutex_unlock(&client->server->mutex);
+                client->queued++;
+                resp_printf(out, "+QUEUED\r\n");
+            }
+            else
+            {
+                pthread_mutex_lock(&client->server->mutex);
+                resp_commands[i].handler(client, argc, argv, out);
+                pthread_mutex_unlock(&client->server->mutex);
+            }
+            return;
+        }
+    }
+    resp_printf(out, "-ERR unknown command '%s'\r\n", argv[0]);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// connections
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Parses one command array of bulk strings
+ *
+ * @return ssize_t bytes used | 0 incomplete | -1 protocol error
+ */
+static ssize_t resp_parse(char *buffer, size_t length, int *argc, char ***argv)
+{
+    char *limit = buffer + length;
+    char *end = length ? memmem(buffer, length, "\r\n", 2) : NULL;
+    if (!end)
+    {
+        return 0;
+    }
+    long count = strtol(buffer + 1, NULL, 10);
+    if (('*' != buffer[0]) || (count < 1) || (count > 1024 * 1024))
+    {
+        return -1;
+    }
+
+    char **args = calloc(count, sizeof(char *));
+    ssize_t used = args ? 0 : -1;
+    char *ptr = end + 2;
+    for (long i = 0; args && (i < count); i++)
+    {
+        end = (ptr < limit) ? memmem(ptr, limit - ptr, "\r\n", 2) : NULL;
+        long size = end ? strtol(ptr + 1, NULL, 10) : 0;
+        if (end && (('$' != ptr[0]) || (size < 0)))
+        {
+            used = -1;
+            break;
+        }
+        if (!end || (end + 2 + size + 2 > limit))
+        {
+            break;
+        }
+        if (!(args[i] = malloc(size + 1)))
+        {
+            used = -1;
+            break;
+        }
+        memcpy(args[i], end + 2, size);
+        args[i][size] = 0;
+        ptr = end + 2 + size + 2;
+        if (i == count - 1)
+        {
+            used = ptr - buffer;
+        }
+    }
+    if (used <= 0)
+    {
+        for (long i = 0; args && (i < count); i++)
+        {
+            FREE_AND_NULL(args[i]);
+        }
+        FREE_AND_NULL(args);
+        return used;
+    }
+    *argc = (int)count;
+    *argv = args;
+    return used;
+}
+
+/**
+ * Counts the command and applies the matching rules
+ *
+ * @param server
+ * @param command
+ * @param delay largest delay of the batch in microseconds
+ * @return resp_fault
+ */
+static resp_fault resp_rules(resp_server *server, char *command, int *delay)
+{
+    resp_fault fault = RESP_FAULT_NONE;
+    pthread_mutex_lock(&server->mutex);
+    server->commands++;
+    for (int i = 0; i < server->count; i++)
+    {
+        resp_rule *rule = &server->rules[i];
+        if (!rule->command[0] || !strcasecmp(rule->command, command))
+        {
+            rule->seen++;
+            int hit = (rule->every <= 0) || (0 == rule->seen % rule->every);
+            int wait = hit ? rule->delay + (rule->jitter > 0 ? rand_r(&server->seed) % rule->jitter : 0) : 0;
+            *delay = wait > *delay ? wait : *delay;
+            if (!fault && rule->fault && (rule->every > 0) && hit)
+            {
+                fault = rule->fault;
+            }
+        }
+    }
+    pthread_mutex_unlock(&server->mutex);
+    return fault;
+}
+
+static int resp_send(int fd, resp_out *out)
+{
+    for (size_t sent = 0; sent < out->length;)
+    {
+        // a client gone with replies in flight must not kill the tests
+        ssize_t n = send(fd, out->data + sent, out->length - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            if ((n < 0) && (EINTR == errno))
+            {
+                continue;
+            }
+            return 0;
+        }
+        sent += n;
+    }
+    out->length = 0;
+    return 1;
+}
+
+static void *resp_client_thread(void *arg)
+{
+    resp_client *client = arg;
+    resp_server *server = client->server;
+    char *buffer = NULL;
+    size_t length = 0, size = 0;
+    resp_out out = {NULL, 0, 0};
+    int stalled = 0;
+    int closing = 0;
+
+    while (!closing)
+    {
+        if (length == size)
+        {
+            char *grown = realloc(buffer, size + RESP_READ);
+            if (!grown)
+            {
+                break;
+            }
+            buffer = grown;
+            size += RESP_READ;
+        }
+        ssize_t n = read(client->fd, buffer + length, size - length);
+        if (n <= 0)
+        {
+            if ((n < 0) && (EINTR == errno))
+            {
+                continue;
+            }
+            break;
+        }
+        length += n;
+        if (stalled)
+        {
+            length = 0;
+            continue;
+        }
+
+        // all complete commands of the read are one round trip
+        size_t offset = 0;
+        int delay = 0;
+        int commands = 0;
+        while (!closing && !stalled)
+        {
+            int argc = 0;
+            char **argv = NULL;
+            ssize_t used = resp_parse(buffer + offset, length - offset, &argc, &argv);
+            if (used <= 0)
+            {
+                closing = (used < 0);
+                break;
+            }
+            offset += used;
+            commands++;
+
+            switch (resp_rules(server, argv[0], &delay))
+            {
+            case RESP_FAULT_ERROR:
+                resp_printf(&out, "-ERR injected fault\r\n");
+                break;
+            case RESP_FAULT_CLOSE:
+                closing = 1;
+                break;
+            case RESP_FAULT_LOST:
+            {
+                size_t sent = out.length;
+                resp_execute(client, argc, argv, &out);
+                out.length = sent;
+                closing = 1;
+                break;
+            }
+            case RESP_FAULT_STALL:
+                stalled = 1;
+                break;
+            default:
+                resp_execute(client, argc, argv, &out);
+                break;
+            }
+            for (int i = 0; i < argc; i++)
+            {
+                FREE_AND_NULL(argv[i]);
+            }
+            FREE_AND_NULL(argv);
+        }
+        memmove(buffer, buffer + offset, length - offset);
+        length -= offset;
+
+        if (commands)
+        {
+            pthread_mutex_lock(&server->mutex);
+            server->batches++;
+            client->held = (delay > 0);
+            pthread_mutex_unlock(&server->mutex);
+        }
+        if (delay > 0)
+        {
+            usleep(delay);
+            // released before the send, a reply that arrived was not held
+            pthread_mutex_lock(&server->mutex);
+            client->held = 0;
+            pthread_mutex_unlock(&server->mutex);
+        }
+        if (!resp_send(client->fd, &out))
+        {
+            break;
+        }
+    }
+
+    FREE_AND_NULL(out.data);
+    FREE_AND_NULL(buffer);
+    FREE_AND_NULL(client->transaction.data);
+    pthread_mutex_lock(&server->mutex);
+    close(client->fd);
+    client->fd = -1;
+    pthread_mutex_unlock(&server->mutex);
+    return NULL;
+}
+
+static void *resp_accept_thread(void *arg)
+{
+    resp_server *server = arg;
+    for (;;)
+    {
+        int fd = accept(server->listener, NULL, NULL);
+        if (fd < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        resp_client *client = calloc(1, sizeof(resp_client));
+        pthread_mutex_lock(&server->mutex);
+        if (!client || server->stopping)
+        {
+            pthread_mutex_unlock(&server->mutex);
+            FREE_AND_NULL(client);
+            close(fd);
+            continue;
+        }
+        client->server = server;
+        client->fd = fd;
+        if (pthread_create(&client->thread, NULL, resp_client_thread, client))
+        {
+            pthread_mutex_unlock(&server->mutex);
+            FREE_AND_NULL(client);
+            close(fd);
+            continue;
+        }
+        client->next = server->clients;
+        server->clients = client;
+        pthread_mutex_unlock(&server->mutex);
+    }
+    return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// server
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Starts the server on the loopback interface
+ *
+ * @param port 0 = any free port
+ * @param auth password required by AUTH | NULL
+ * @return resp_server* | NULL
+ */
+resp_server *resp_server_start(int port, char *auth)
+{
+    resp_server *server = calloc(1, sizeof(resp_server));
+    if (!server)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&server->mutex, NULL);
+    server->seed = 1;
+    server->auth = (auth && auth[0]) ? strdup(auth) : NULL;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    int one = 1;
+
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if ((server->listener >= 0) &&
+        !setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) &&
+        !bind(server->listener, (struct sockaddr *)&address, sizeof(address)) &&
+        !listen(server->listener, 64) &&
+        !getsockname(server->listener, (struct sockaddr *)&address, &length) &&
+        !pthread_create(&server->thread, NULL, resp_accept_thread, server))
+    {
+        server->port = ntohs(address.sin_port);
+        return server;
+    }
+
+    if (server->listener >= 0)
+    {
+        close(server->listener);
+    }
+    FREE_AND_NULL(server->auth);
+    pthread_mutex_destroy(&server->mutex);
+    free(server);
+    return NULL;
+}
+
+int resp_server_port(resp_server *server)
+{
+    return server ? server->port : 0;
+}
+
+/**
+ * Adds a rule for the command, all matching rules apply
+ *
+ * @param server
+ * @param command | NULL for every command
+ * @param delay microseconds before the replies of the read
+ * @param jitter random microseconds added to the delay
+ * @param fault
+ * @param every the delay and the fault hit every n-th matching command, 0 = the delay hits all of them
+ * @return int 1 | 0
+ */
+int resp_server_rule(resp_server *server, char *command, int delay, int jitter, resp_fault fault, long long every)
+{
+    int ok = 0;
+    pthread_mutex_lock(&server->mutex);
+    if (server->count < RESP_RULES)
+    {
+        resp_rule *rule = &server->rules[server->count++];
+        memset(rule, 0, sizeof(resp_rule));
+        snprintf(rule->command, sizeof(rule->command), "%s", command ? command : "");
+        rule->delay = delay;
+        rule->jitter = jitter;
+        rule->fault = fault;
+        rule->every = every;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&server->mutex);
+    return ok;
+}
+
+/**
+ * Removes all rules
+ *
+ * @param server
+ */
+void resp_server_clear(resp_server *server)
+{
+    pthread_mutex_lock(&server->mutex);
+    server->count = 0;
+    pthread_mutex_unlock(&server->mutex);
+}
+
+/**
+ * Gets the counters since the start
+ *
+ * @param server
+ * @param commands received commands | NULL
+ * @param batches reads with commands, i.e. round trips | NULL
+ */
+void resp_server_stats(resp_server *server, long long *commands, long long *batches)
+{
+    pthread_mutex_lock(&server->mutex);
+    if (commands)
+    {
+        *commands = server->commands;
+    }
+    if (batches)
+    {
+        *batches = server->batches;
+    }
+    pthread_mutex_unlock(&server->mutex);
+}
+
+/**
+ * Counts the connections whose replies are held back by a delay,
+ * a read answered meanwhile came over another connection
+ *
+ * @param server
+ * @return int
+ */
+int resp_server_held(resp_server *server)
+{
+    int held = 0;
+    pthread_mutex_lock(&server->mutex);
+    for (resp_client *client = server->clients; client; client = client->next)
+    {
+        held += client->held;
+    }
+    pthread_mutex_unlock(&server->mutex);
+    return held;
+}
+
+/**
+ * Closes all connections and frees the server
+ *
+ * @param server
+ */
+void resp_server_stop(resp_server *server)
+{
+    if (!server)
+    {
+        return;
+    }
+    pthread_mutex_lock(&server->mutex);
+    server->stopping = 1;
+    pthread_mutex_unlock(&server->mutex);
+    shutdown(server->listener, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->listener);
+
+    pthread_mutex_lock(&server->mutex);
+    for (resp_client *client = server->clients; client; client = client->next)
+    {
+        if (client->fd >= 0)
+        {
+            shutdown(client->fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&server->mutex);
+    while (server->clients)
+    {
+        resp_client *client = server->clients;
+        server->clients = client->next;
+        pthread_join(client->thread, NULL);
+        free(client);
+    }
+
+    for (int base = 0; base < RESP_DATABASES; base++)
+    {
+        for (int i = 0; i < RESP_SLOTS; i++)
+        {
+            while (server->slots[base][i])
+            {
+                resp_entry *entry = server->slots[base][i];
+                server->slots[base][i] = entry->next;
+                resp_entry_free(entry);
+            }
+        }
+    }
+    FREE_AND_NULL(server->auth);
+    pthread_mutex_destroy(&server->mutex);
+    free(server);
+}
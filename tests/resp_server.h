@@ -0,0 +1,34 @@
+#ifndef RESP_SERVER_H
+#define RESP_SERVER_H
+
+/**
+ * In-process RESP server standing in for Redis in the tests.
+ * It knows the commands the library uses for the basic types:
+ * PING AUTH SELECT TYPE GET SET MSET DEL HSET HGETALL SADD SMEMBERS SCARD
+ * RPUSH LPUSH LRANGE LTRIM LLEN INCRBY TTL EXPIRE FLUSHDB MULTI EXEC.
+ *
+ * Every connection is served by its own thread, the commands of one read
+ * are answered together after the largest delay of their rules,
+ * so a pipeline pays the injected round trip once.
+ */
+
+typedef enum resp_fault
+{
+    RESP_FAULT_NONE,
+    RESP_FAULT_ERROR, // -ERR reply instead of the command
+    RESP_FAULT_CLOSE, // the connection is closed before the reply
+    RESP_FAULT_LOST,  // the command runs, the connection is closed before its reply
+    RESP_FAULT_STALL, // the connection never replies again
+} resp_fault;
+
+typedef struct resp_server resp_server;
+
+resp_server *resp_server_start(int port, char *auth);
+int resp_server_port(resp_server *server);
+int resp_server_rule(resp_server *server, char *command, int delay, int jitter, resp_fault fault, long long every);
+void resp_server_clear(resp_server *server);
+void resp_server_stats(resp_server *server, long long *commands, long long *batches);
+int resp_server_held(resp_server *server);
+void resp_server_stop(resp_server *server);
+
+#endif // RESP_SERVER_H
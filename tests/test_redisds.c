@@ -2,6 +2,7 @@
  * @author Yurii Prudius
  **/
 #include "defines.h"
+#include "resp_server.h"
 
 #include <CUnit/Basic.h>
 #include <cjson/cJSON.h>
@@ -11,14 +12,73 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <redisds/redis_ds.h>
 #include <syslog.h>
+#include <time.h>
 
 static char host[] = "redis";
 static int port = 6379;
 static char auth[] = "";
 static int timeout = 1500;
 static long long ttl = 15;
+static char tool[] = "../tools/redisds-tool";
+
+static long long elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static resp_server *standin = NULL;
+
+/**
+ * Checks once whether the Redis server of the tests answers
+ *
+ * @return int 1 | 0
+ */
+static int redis_available(void)
+{
+    static int available = -1;
+    if (available < 0)
+    {
+        struct timeval tv = {0, 500000};
+        redisContext *redis = redisConnectWithTimeout(host, port, tv);
+        available = redis && !redis->err;
+        if (redis)
+        {
+            redisFree(redis);
+        }
+        if (!available)
+        {
+            printf("\n%s:%d is unreachable, the tests of the stand-in server run alone\n", host, port);
+        }
+    }
+    return available;
+}
+
+/**
+ * Opens the Redis server of the tests,
+ * the stand-in server shared by the basic type tests takes its place when it is unreachable
+ *
+ * @return int 1 | 0
+ */
+static int open_basic(void)
+{
+    if (redis_available())
+    {
+        return redisDS_serverOpen(host, port, auth, timeout);
+    }
+    if (!standin && !(standin = resp_server_start(0, auth)))
+    {
+        return 0;
+    }
+    return redisDS_serverOpen("127.0.0.1", resp_server_port(standin), auth, timeout);
+}
 
 static void test_store(void)
 {
@@ -26,7 +86,7 @@ static void test_store(void)
 
     openlog(NULL, 0, LOG_MAIL);
 
-    int open = redisDS_serverOpen(host, port, auth, timeout);
+    int open = open_basic();
     CU_ASSERT_EQUAL_FATAL(open, 1);
 
     START_USING_TEST_DATA("data/")
@@ -72,13 +132,1377 @@ static void test_store(void)
     closelog();
 }
 
+static void test_read(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = open_basic();
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        char *key = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %ms", &dataset, &database, &prefix, &key);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+
+            cJSON *json = redisDS_read(name, "%s", key);
+            cJSON *pooled = redisDS_readArena(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            CU_ASSERT_PTR_NOT_NULL(pooled);
+            if (json && pooled)
+            {
+                char *strjson = cJSON_PrintUnformatted(json);
+                char *strpooled = cJSON_PrintUnformatted(pooled);
+                printf("%s %s=%s\n", name, strjson, strpooled);
+                CU_ASSERT_STRING_EQUAL(strjson, strpooled);
+                FREE_AND_NULL(strpooled);
+                FREE_AND_NULL(strjson);
+            }
+            // only the root of an arena tree is released
+            errno = 0;
+            redisDS_release(json);
+            CU_ASSERT_EQUAL(errno, EINVAL);
+            errno = 0;
+            redisDS_release(pooled && pooled->child ? pooled->child : json);
+            CU_ASSERT_EQUAL(errno, EINVAL);
+            redisDS_release(pooled);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_set(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = open_basic();
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        char *key = NULL;
+        char *value = NULL;
+        int noreply = 0;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %ms %ms %d", &dataset, &database, &prefix, &key, &value, &noreply);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_NOREPLY, noreply), 1);
+
+            redisDS_set(name, "%s", "%s", ttl, key, value);
+            CU_ASSERT_EQUAL(redisDS_sync(name), 1);
+
+            cJSON *json = redisDS_read(name, "%s", key);
+            printf("%s %s=%s\n", name, value, cJSON_GetStringValue(json));
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+typedef struct increment_job
+{
+    char *name;
+    char *key;
+    int count;
+} increment_job;
+
+static void *increment_thread(void *arg)
+{
+    increment_job *job = arg;
+    for (int i = 0; i < job->count; i++)
+    {
+        redisDS_increment(job->name, "%s", 1, ttl, job->key);
+    }
+    return NULL;
+}
+
+static void test_increment(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = open_basic();
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        char *key = NULL;
+        int threads = 0;
+        int count = 0;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %ms %d %d", &dataset, &database, &prefix, &key, &threads, &count);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL_FATAL(redisDS_option(name, REDIS_DS_AUTOPIPELINE, 1), 1);
+
+            long long first = redisDS_increment(name, "%s", 0, ttl, key);
+
+            pthread_t thread[threads];
+            increment_job job = {name, key, count};
+            for (int i = 0; i < threads; i++)
+            {
+                pthread_create(&thread[i], NULL, increment_thread, &job);
+            }
+            for (int i = 0; i < threads; i++)
+            {
+                pthread_join(thread[i], NULL);
+            }
+
+            long long last = redisDS_increment(name, "%s", 0, ttl, key);
+            printf("%s %d=%lld\n", name, threads * count, last - first);
+            CU_ASSERT_EQUAL(last - first, threads * count);
+        }
+        // -code
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_cache(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = redisDS_serverOpen(host, port, auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+    CU_ASSERT_EQUAL_FATAL(redisDS_cacheOpen("/redisds_test", 1 << 20), 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %ms %ms", &dataset, &database, &prefix, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_CACHE, 1000), 1);
+
+            // the write drops the value cached by the previous line
+            redisDS_set(name, "%s", "%s", ttl, key, value);
+
+            cJSON *json = redisDS_read(name, "%s", key);
+            cJSON *cached = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(cached);
+            printf("%s %s=%s\n", name, cJSON_GetStringValue(json), cJSON_GetStringValue(cached));
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(cached), value);
+            cJSON_Delete(cached);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    // the cached value does not outlive the key
+    CU_ASSERT_EQUAL(redisDS_option("workspace", REDIS_DS_CACHE, 60000), 1);
+    redisDS_set("workspace", "scalar:short", "%s", 1, "lived");
+    cJSON *json = redisDS_read("workspace", "scalar:short");
+    CU_ASSERT_PTR_NOT_NULL(json);
+    cJSON_Delete(json);
+    usleep(1100000);
+    json = redisDS_read("workspace", "scalar:short");
+    CU_ASSERT_PTR_NULL(json);
+    cJSON_Delete(json);
+
+    // the stored object drops the cached values of its keys
+    cJSON *before = cJSON_Parse("{\"scalar:stored\": \"before\"}");
+    cJSON *after = cJSON_Parse("{\"scalar:stored\": \"after\"}");
+    CU_ASSERT_EQUAL(redisDS_store("workspace", before, ttl), 1);
+    json = redisDS_read("workspace", "scalar:stored");
+    cJSON_Delete(json);
+    CU_ASSERT_EQUAL(redisDS_store("workspace", after, ttl), 1);
+    json = redisDS_read("workspace", "scalar:stored");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+    CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), "after");
+    cJSON_Delete(json);
+    cJSON_Delete(after);
+    cJSON_Delete(before);
+
+    redisDS_cacheClose();
+    redisDS_serverClose();
+}
+
+static void test_approximate(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = redisDS_serverOpen(host, port, auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        char *key = NULL;
+        int members = 0;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %ms %d", &dataset, &database, &prefix, &key, &members);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_APPROXIMATE, 1), 1);
+
+            long long count = 0;
+            for (int i = 0; i < members; i++)
+            {
+                count = redisDS_append(name, "%s", "member%d", ttl, key, i % (members / 2 + 1));
+            }
+            cJSON *json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            long long expected = members / 2 + 1;
+            printf("%s %lld~%lld~%.0f\n", name, expected, count, cJSON_GetNumberValue(json));
+            CU_ASSERT(llabs(count - expected) * 50 <= expected);
+            CU_ASSERT_EQUAL((long long)cJSON_GetNumberValue(json), count);
+            cJSON_Delete(json);
+
+            // a plain string of the dataspace is not counted, even when it looks like a HyperLogLog
+            redisDS_set(name, "%s:plain", "HYLL plain", ttl, key);
+            json = redisDS_read(name, "%s:plain", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), "HYLL plain");
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_buckets(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = redisDS_serverOpen(host, port, auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int buckets = 0;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &buckets, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_BUCKETS, buckets), 1);
+
+            CU_ASSERT_EQUAL(redisDS_set(name, "%s", "%s", ttl, key, value), ttl);
+            cJSON *json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            printf("%s %s=%s\n", name, value, cJSON_GetStringValue(json));
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            cJSON_Delete(json);
+
+            long long first = redisDS_increment(name, "%s:counter", 1, ttl, key);
+            long long second = redisDS_increment(name, "%s:counter", 2, ttl, key);
+            CU_ASSERT_EQUAL(second - first, 2);
+
+            // the set is not bucketed, it is read from its own key
+            CU_ASSERT_EQUAL(redisDS_append(name, "%s:members", "%s", ttl, key, value), 1);
+            json = redisDS_read(name, "%s:members", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT(cJSON_IsArray(json));
+            CU_ASSERT_EQUAL(cJSON_GetArraySize(json), 1);
+            cJSON_Delete(json);
+
+            // the separator of the bucket names is reserved
+            CU_ASSERT_EQUAL(redisDS_set(name, "\x1f%d", "%s", ttl, 0, value), 0);
+            CU_ASSERT_PTR_NULL(redisDS_read(name, "\x1f%d", 0));
+
+            // a no-reply write without TTL keeps the other fields of its bucket
+            char single[64];
+            snprintf(single, sizeof(single), "%s_single", name);
+            CU_ASSERT_EQUAL_FATAL(redisDS_register(single, database, "%s", prefix), 1);
+            CU_ASSERT_EQUAL(redisDS_option(single, REDIS_DS_BUCKETS, 1), 1);
+            CU_ASSERT_EQUAL(redisDS_option(single, REDIS_DS_NOREPLY, 1), 1);
+            redisDS_set(single, "%s:neighbour", "%s", 0, key, value);
+            redisDS_set(single, "%s:forever", "%s", 0, key, value);
+            CU_ASSERT_EQUAL(redisDS_sync(single), 1);
+            json = redisDS_read(single, "%s:neighbour", key);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_deadline(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = open_basic();
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int pipeline = 0;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &pipeline, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_AUTOPIPELINE, pipeline), 1);
+            redisDS_set(name, "%s", "%s", ttl, key, value);
+
+            redisDS_deadline(1000);
+            cJSON *json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            printf("%s %s=%s\n", name, value, cJSON_GetStringValue(json));
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            cJSON_Delete(json);
+
+            // the expired deadline fails without touching the connection
+            redisDS_deadline(1);
+            usleep(5000);
+            errno = 0;
+            json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NULL(json);
+            CU_ASSERT_EQUAL(errno, ETIMEDOUT);
+            cJSON_Delete(json);
+
+            redisDS_deadline(0);
+            json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void migrate_progress(const redis_migration *migration, void *arg)
+{
+    *(long long *)arg = migration->moved;
+}
+
+static void test_migrate(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = redisDS_serverOpen(host, port, auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int target = 0;
+        char *moved = NULL;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms %ms", &dataset, &database, &prefix, &target, &moved, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            redisDS_set(name, "%s", "%s", ttl, key, value);
+
+            long long progress = 0;
+            CU_ASSERT_EQUAL(redisDS_migrate(name, NULL, target, moved, 2, 0, migrate_progress, &progress), 1);
+            CU_ASSERT(progress >= 1);
+
+            // the registration reads the copy now
+            redisDS_set(name, "%s", "%s", ttl, key, "changed");
+            redisDS_register("source", database, "%s", prefix);
+            cJSON *json = redisDS_read(name, "%s", key);
+            cJSON *source = redisDS_read("source", "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(source);
+            printf("%s %s=%s\n", name, value, cJSON_GetStringValue(source));
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), "changed");
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(source), value);
+            cJSON_Delete(source);
+            cJSON_Delete(json);
+
+            // the same server as the target is copied by RESTORE, not by a MIGRATE to itself
+            redis_server server = {host, port, auth, timeout, 0};
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            CU_ASSERT_EQUAL(redisDS_migrate(name, &server, target + 1, NULL, 2, 0, NULL, NULL), 1);
+            long long elapsed = elapsed_ms(&start);
+            printf("%s same server in %lldms\n", name, elapsed);
+            CU_ASSERT(elapsed < 1000);
+            json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), "changed");
+            cJSON_Delete(json);
+
+            // the target server is added before, not by the migration
+            redis_server unknown = {"127.0.0.1", 1, NULL, timeout, 0};
+            errno = 0;
+            CU_ASSERT_EQUAL(redisDS_migrate(name, &unknown, target, NULL, 2, 0, NULL, NULL), 0);
+            CU_ASSERT_EQUAL(errno, EINVAL);
+
+            // with REDIS_DS_MIGRATE_DELETE the keys move, the source is emptied
+            char moving[64];
+            snprintf(moving, sizeof(moving), "%s_moving", name);
+            CU_ASSERT_EQUAL_FATAL(redisDS_register(moving, database, "%smoving.", prefix), 1);
+            CU_ASSERT_EQUAL(redisDS_register("moving_source", database, "%smoving.", prefix), 1);
+            CU_ASSERT_EQUAL(redisDS_option(moving, REDIS_DS_MIGRATE_DELETE, 1), 1);
+            redisDS_set(moving, "%s", "%s", ttl, key, value);
+            CU_ASSERT_EQUAL(redisDS_migrate(moving, NULL, target, moved, 2, 0, NULL, NULL), 1);
+            json = redisDS_read(moving, "%s", key);
+            source = redisDS_read("moving_source", "%s", key);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            CU_ASSERT_PTR_NULL(source);
+            cJSON_Delete(source);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(moved);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_hotkeys(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = open_basic();
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int hot = 0;
+        char *key = NULL;
+        char *other = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &hot, &key, &other);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_PTR_NULL(redisDS_hotKeys(name, 1));
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HOTKEYS, 1), 1);
+
+            for (int i = 0; i < hot; i++)
+            {
+                redisDS_increment(name, "%s", 1, ttl, key);
+            }
+            redisDS_increment(name, "%s", 1, ttl, other);
+
+            cJSON *json = redisDS_hotKeys(name, 1);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_EQUAL(cJSON_GetArraySize(json), 1);
+            cJSON *top = cJSON_GetArrayItem(json, 0);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(top);
+            char *fullkey = cJSON_GetStringValue(cJSON_GetObjectItem(top, "key"));
+            double count = cJSON_GetNumberValue(cJSON_GetObjectItem(top, "count"));
+            printf("%s %s=%.0f\n", name, fullkey, count);
+            CU_ASSERT(fullkey && strstr(fullkey, key) && !strncmp(fullkey, prefix, strlen(prefix)));
+            CU_ASSERT(count >= hot);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(other);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_memory(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = redisDS_serverOpen(host, port, auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int members = 0;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &members, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+
+            redisDS_set(name, "%s:small", "%s", ttl, key, value);
+            for (int i = 0; i < members; i++)
+            {
+                redisDS_append(name, "%s:large", "%s:%d", ttl, key, value, i);
+            }
+
+            cJSON *json = redisDS_memoryReport(name, 1);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            double keys = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "keys"));
+            double sampled = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "sampled"));
+            cJSON *largest = cJSON_GetArrayItem(cJSON_GetObjectItem(json, "largest"), 0);
+            char *top = cJSON_GetStringValue(cJSON_GetObjectItem(largest, "key"));
+            printf("%s %.0f keys, %.0f bytes, largest %s\n", name, keys,
+                   cJSON_GetNumberValue(cJSON_GetObjectItem(json, "bytes")), top);
+            CU_ASSERT(keys >= 2);
+            CU_ASSERT_EQUAL(keys, sampled);
+            CU_ASSERT(top && strstr(top, ":large"));
+            CU_ASSERT_PTR_NOT_NULL(cJSON_GetObjectItem(json, "histogram"));
+            CU_ASSERT(cJSON_GetArraySize(cJSON_GetObjectItem(json, "encodings")) >= 1);
+            cJSON_Delete(json);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_standin(void)
+{
+    printf("\n%s\n", __func__);
+
+    resp_server *server = resp_server_start(0, auth);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+    int open = redisDS_serverOpen("127.0.0.1", resp_server_port(server), auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int delay = 0;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &delay, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+
+            CU_ASSERT_EQUAL(redisDS_set(name, "%s", "%s", ttl, key, value), ttl);
+            CU_ASSERT_EQUAL(redisDS_increment(name, "%s:counter", 5, ttl, key), 5);
+            CU_ASSERT_EQUAL(redisDS_append(name, "%s:members", "%s", ttl, key, value), 1);
+            cJSON *json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            cJSON_Delete(json);
+
+            // the delayed GET is one round trip of the read, answered after the delay
+            long long commands = 0, batches = 0, sent = 0, trips = 0;
+            resp_server_rule(server, "GET", delay, 0, RESP_FAULT_NONE, 0);
+            resp_server_stats(server, &commands, &batches);
+            json = redisDS_read(name, "%s", key);
+            resp_server_stats(server, &sent, &trips);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            CU_ASSERT_EQUAL(sent - commands, 2);
+            CU_ASSERT_EQUAL(trips - batches, 2);
+            CU_ASSERT_EQUAL(resp_server_held(server), 0);
+            cJSON_Delete(json);
+            resp_server_clear(server);
+
+            // every command of a synchronous write is a round trip
+            resp_server_stats(server, &commands, &batches);
+            for (int i = 0; i < 20; i++)
+            {
+                redisDS_set(name, "%s:%d", "%s", ttl, key, i, value);
+            }
+            resp_server_stats(server, &sent, &trips);
+            CU_ASSERT_EQUAL(sent - commands, trips - batches);
+
+            // no-reply writes share the round trips
+            resp_server_rule(server, NULL, delay, 0, RESP_FAULT_NONE, 0);
+            redisDS_option(name, REDIS_DS_NOREPLY, 1);
+            resp_server_stats(server, &commands, &batches);
+            for (int i = 0; i < 20; i++)
+            {
+                redisDS_set(name, "%s:%d", "%s", ttl, key, i, value);
+            }
+            CU_ASSERT_EQUAL(redisDS_sync(name), 1);
+            resp_server_stats(server, &sent, &trips);
+            printf("%s %lld commands in %lld round trips\n", name, sent - commands, trips - batches);
+            CU_ASSERT(2 * (trips - batches) < sent - commands);
+            redisDS_option(name, REDIS_DS_NOREPLY, 0);
+            resp_server_clear(server);
+
+            // injected errors fail the read, a closed connection is retried
+            resp_server_rule(server, "GET", 0, 0, RESP_FAULT_ERROR, 1);
+            json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NULL(json);
+            cJSON_Delete(json);
+            resp_server_clear(server);
+            resp_server_rule(server, "GET", 0, 0, RESP_FAULT_CLOSE, 1);
+            json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NULL(json);
+            cJSON_Delete(json);
+            resp_server_clear(server);
+            resp_server_rule(server, "GET", 0, 0, RESP_FAULT_CLOSE, 2);
+            json = redisDS_read(name, "%s", key);
+            cJSON *retried = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            CU_ASSERT_PTR_NOT_NULL(retried);
+            cJSON_Delete(retried);
+            cJSON_Delete(json);
+            resp_server_clear(server);
+
+            // an auto-pipelined write is not resent after its reply was lost
+            redisDS_option(name, REDIS_DS_AUTOPIPELINE, 1);
+            resp_server_rule(server, "INCRBY", 0, 0, RESP_FAULT_LOST, 1);
+            CU_ASSERT_EQUAL(redisDS_increment(name, "%s:lost", 1, ttl, key), 0);
+            resp_server_clear(server);
+            json = redisDS_read(name, "%s:lost", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), "1");
+            cJSON_Delete(json);
+            redisDS_option(name, REDIS_DS_AUTOPIPELINE, 0);
+
+            // an approximate dataspace reads a plain string by TYPE and GET, without PFCOUNT
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_APPROXIMATE, 1), 1);
+            resp_server_stats(server, &commands, NULL);
+            json = redisDS_read(name, "%s", key);
+            resp_server_stats(server, &sent, NULL);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            CU_ASSERT_EQUAL(sent - commands, 2);
+            cJSON_Delete(json);
+            redisDS_option(name, REDIS_DS_APPROXIMATE, 0);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+    resp_server_stop(server);
+}
+
+static void test_hedge(void)
+{
+    printf("\n%s\n", __func__);
+
+    resp_server *server = resp_server_start(0, auth);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+    int open = redisDS_serverOpen("127.0.0.1", resp_server_port(server), auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int delay = 0;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &delay, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL(redisDS_set(name, "%s", "%s", ttl, key, value), ttl);
+
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HEDGE, -2), 0);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HEDGE_RATE, 101), 0);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HEDGE, delay / 10000), 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HEDGE_RATE, 100), 1);
+
+            // every other GET is slow, the hedges take the fast turns after the first read,
+            // the duplicate over the spare connection wins while the slow reply is still held
+            resp_server_rule(server, "GET", delay, 0, RESP_FAULT_NONE, 2);
+            for (int i = 0; i < 5; i++)
+            {
+                cJSON *json = redisDS_read(name, "%s", key);
+                CU_ASSERT_EQUAL(resp_server_held(server), i > 0);
+                CU_ASSERT_PTR_NOT_NULL(json);
+                CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+                cJSON_Delete(json);
+                // the lagging connection catches up
+                usleep(delay);
+            }
+
+            // no hedges over the rate
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HEDGE_RATE, 0), 1);
+            resp_server_clear(server);
+            resp_server_rule(server, "GET", delay, 0, RESP_FAULT_NONE, 0);
+            long long commands = 0, sent = 0;
+            resp_server_stats(server, &commands, NULL);
+            cJSON *json = redisDS_read(name, "%s", key);
+            resp_server_stats(server, &sent, NULL);
+            CU_ASSERT_EQUAL(sent - commands, 2);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            cJSON_Delete(json);
+            resp_server_clear(server);
+
+            // the adaptive delay follows the p95 of the fast reads
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HEDGE, -1), 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_HEDGE_RATE, 100), 1);
+            for (int i = 0; i < 64; i++)
+            {
+                cJSON_Delete(redisDS_read(name, "%s", key));
+            }
+            resp_server_rule(server, "GET", delay, 0, RESP_FAULT_NONE, 2);
+            cJSON_Delete(redisDS_read(name, "%s", key));
+            json = redisDS_read(name, "%s", key);
+            CU_ASSERT_EQUAL(resp_server_held(server), 1);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            cJSON_Delete(json);
+            resp_server_clear(server);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+    resp_server_stop(server);
+}
+
+static void test_setmany(void)
+{
+    printf("\n%s\n", __func__);
+
+    resp_server *server = resp_server_start(0, auth);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+    int open = redisDS_serverOpen("127.0.0.1", resp_server_port(server), auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int count = 0;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms", &dataset, &database, &prefix, &count, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+
+            char **keys = calloc(count, sizeof(char *));
+            char **values = calloc(count, sizeof(char *));
+            int *status = calloc(count, sizeof(int));
+            CU_ASSERT_FATAL(keys && values && status);
+            for (int i = 0; i < count; i++)
+            {
+                CU_ASSERT_NOT_EQUAL(asprintf(&keys[i], "key%d", i), -1);
+                values[i] = value;
+            }
+
+            // one MSET per chunk
+            long long commands = 0, batches = 0, sent = 0, trips = 0;
+            resp_server_stats(server, &commands, &batches);
+            CU_ASSERT_EQUAL(redisDS_setMany(name, keys, values, count, 0, status), count);
+            resp_server_stats(server, &sent, &trips);
+            printf("%s %d keys in %lld commands, %lld round trips\n", name, count, sent - commands, trips - batches);
+            CU_ASSERT_EQUAL(sent - commands, trips - batches);
+            CU_ASSERT(trips - batches < count / 10);
+            CU_ASSERT_EQUAL(status[count - 1], 1);
+            cJSON *json = redisDS_read(name, "%s", keys[count - 1]);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(json), value);
+            cJSON_Delete(json);
+
+            // SET EX per key inside MULTI/EXEC, a missing value fails its key only
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_ATOMIC, 1), 1);
+            values[1] = NULL;
+            resp_server_stats(server, &commands, &batches);
+            CU_ASSERT_EQUAL(redisDS_setMany(name, keys, values, count, ttl, status), count - 1);
+            resp_server_stats(server, &sent, &trips);
+            CU_ASSERT(sent - commands > count);
+            CU_ASSERT(trips - batches < count / 10);
+            CU_ASSERT_EQUAL(status[0], 1);
+            CU_ASSERT_EQUAL(status[1], 0);
+            CU_ASSERT_EQUAL(status[count - 1], 1);
+            values[1] = value;
+
+            // no-reply chunks are checked by the sync
+            redisDS_option(name, REDIS_DS_NOREPLY, 1);
+            CU_ASSERT_EQUAL(redisDS_setMany(name, keys, values, count, ttl, NULL), count);
+            CU_ASSERT_EQUAL(redisDS_sync(name), 1);
+            redisDS_option(name, REDIS_DS_NOREPLY, 0);
+
+            // auto-pipelined chunks are one request each, a failed key fails alone
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_AUTOPIPELINE, 1), 1);
+            resp_server_stats(server, &commands, &batches);
+            CU_ASSERT_EQUAL(redisDS_setMany(name, keys, values, count, ttl, status), count);
+            resp_server_stats(server, &sent, &trips);
+            CU_ASSERT(trips - batches < count / 10);
+            resp_server_rule(server, "SET", 0, 0, RESP_FAULT_ERROR, count);
+            CU_ASSERT_EQUAL(redisDS_setMany(name, keys, values, count, ttl, status), count - 1);
+            CU_ASSERT_EQUAL(status[count - 2], 1);
+            CU_ASSERT_EQUAL(status[count - 1], 0);
+            resp_server_clear(server);
+            redisDS_option(name, REDIS_DS_AUTOPIPELINE, 0);
+            redisDS_option(name, REDIS_DS_ATOMIC, 0);
+
+            // bucketed keys without a TTL are written all the same
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_BUCKETS, 16), 1);
+            CU_ASSERT_EQUAL(redisDS_setMany(name, keys, values, count, 0, status), count);
+            CU_ASSERT_EQUAL(status[0], 1);
+            CU_ASSERT_EQUAL(status[count - 1], 1);
+            redisDS_option(name, REDIS_DS_BUCKETS, 0);
+
+            for (int i = 0; i < count; i++)
+            {
+                FREE_AND_NULL(keys[i]);
+            }
+            FREE_AND_NULL(keys);
+            FREE_AND_NULL(values);
+            FREE_AND_NULL(status);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+    resp_server_stop(server);
+}
+
+static void test_ratelimit(void)
+{
+    printf("\n%s\n", __func__);
+
+    int open = redisDS_serverOpen(host, port, auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        long long limit = 0;
+        long long window = 0;
+        char *key = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %lld %lld %ms", &dataset, &database, &prefix, &limit, &window, &key);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+
+            redis_rate rate;
+            int pid = getpid();
+            for (long long i = 1; i <= limit; i++)
+            {
+                CU_ASSERT_EQUAL(redisDS_rateLimit(name, "%s:%d", limit, window, &rate, key, pid), 1);
+                CU_ASSERT_EQUAL(rate.remaining, limit - i);
+                CU_ASSERT(rate.reset > 0 && rate.reset <= window);
+            }
+            CU_ASSERT_EQUAL(redisDS_rateLimit(name, "%s:%d", limit, window, &rate, key, pid), 0);
+            printf("%s denied, retry in %lld ms, reset in %lld ms\n", name, rate.retry, rate.reset);
+            CU_ASSERT(rate.retry > 0 && rate.retry <= window / limit);
+            CU_ASSERT_FALSE(rate.allowed);
+
+            // the key is denied locally without asking the server
+            redisDS_set(name, "%s:%d", "0", ttl, key, pid);
+            CU_ASSERT_EQUAL(redisDS_rateLimit(name, "%s:%d", limit, window, &rate, key, pid), 0);
+            CU_ASSERT(rate.retry > 0);
+            CU_ASSERT_EQUAL(redisDS_rateLimit(name, "%s:%d", limit + 1, window, &rate, key, pid), 1);
+        }
+        // -code
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+}
+
+static void test_push(void)
+{
+    printf("\n%s\n", __func__);
+
+    resp_server *server = resp_server_start(0, auth);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+    int open = redisDS_serverOpen("127.0.0.1", resp_server_port(server), auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int maxlen = 0;
+        char *key = NULL;
+        char *values = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &maxlen, &key, &values);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+
+            cJSON *array = cJSON_Parse(values);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(array);
+            int count = cJSON_GetArraySize(array);
+
+            // push, trim and expire share one round trip
+            long long commands = 0, batches = 0, sent = 0, trips = 0;
+            resp_server_stats(server, &commands, &batches);
+            long long length = redisDS_push(name, "%s", array, maxlen, ttl, key);
+            resp_server_stats(server, &sent, &trips);
+            CU_ASSERT_EQUAL(length, count < maxlen ? count : maxlen);
+            CU_ASSERT_EQUAL(sent - commands, 3);
+            CU_ASSERT_EQUAL(trips - batches, 1);
+
+            length = redisDS_push(name, "%s", array, maxlen, ttl, key);
+            CU_ASSERT_EQUAL(length, maxlen);
+            cJSON *json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_EQUAL(cJSON_GetArraySize(json), maxlen);
+            char *last = cJSON_GetStringValue(cJSON_GetArrayItem(json, maxlen - 1));
+            printf("%s %s last %s\n", name, key, last);
+            CU_ASSERT_STRING_EQUAL(last, cJSON_GetStringValue(cJSON_GetArrayItem(array, count - 1)));
+            cJSON_Delete(json);
+
+            // the newest at the head, the I/O thread takes the push reply in the same round trip
+            redisDS_option(name, REDIS_DS_AUTOPIPELINE, 1);
+            json = redisDS_read(name, "%s", key);
+            cJSON_Delete(json);
+            cJSON *number = cJSON_CreateNumber(count);
+            resp_server_stats(server, &commands, &batches);
+            CU_ASSERT_EQUAL(redisDS_push(name, "%s", number, -maxlen, ttl, key), maxlen);
+            resp_server_stats(server, &sent, &trips);
+            CU_ASSERT_EQUAL(sent - commands, 3);
+            CU_ASSERT_EQUAL(trips - batches, 1);
+            json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_EQUAL(atoi(cJSON_GetStringValue(cJSON_GetArrayItem(json, 0))), count);
+            cJSON_Delete(json);
+            cJSON_Delete(number);
+            redisDS_option(name, REDIS_DS_AUTOPIPELINE, 0);
+            cJSON_Delete(array);
+        }
+        // -code
+        FREE_AND_NULL(values);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+    resp_server_stop(server);
+}
+
+static void test_sliding(void)
+{
+    printf("\n%s\n", __func__);
+
+    resp_server *server = resp_server_start(0, auth);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+    int open = redisDS_serverOpen("127.0.0.1", resp_server_port(server), auth, timeout);
+    CU_ASSERT_EQUAL_FATAL(open, 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int reads = 0;
+        char *key = NULL;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms %ms", &dataset, &database, &prefix, &reads, &key, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_SLIDING, 10 * ttl), 1);
+            CU_ASSERT_EQUAL(redisDS_option(name, REDIS_DS_SLIDING_INTERVAL, 60000), 1);
+            redisDS_set(name, "%s", "%s", ttl, key, value);
+
+            // TYPE + GET per read, TYPE of the missing key, SELECT of the flusher and one EXPIRE
+            long long commands = 0, sent = 0;
+            resp_server_stats(server, &commands, NULL);
+            for (int i = 0; i < reads; i++)
+            {
+                cJSON *json = redisDS_read(name, "%s", key);
+                CU_ASSERT_PTR_NOT_NULL(json);
+                cJSON_Delete(json);
+            }
+            cJSON *missing = redisDS_read(name, "%s:missing", key);
+            CU_ASSERT_PTR_NULL(missing);
+            CU_ASSERT_EQUAL(redisDS_sync(name), 1);
+            resp_server_stats(server, &sent, NULL);
+            printf("%s %d reads, %lld commands\n", name, reads, sent - commands);
+            CU_ASSERT_EQUAL(sent - commands, 2 * reads + 1 + 2);
+
+            // the next refresh after the interval
+            redisDS_option(name, REDIS_DS_SLIDING_INTERVAL, 0);
+            resp_server_stats(server, &commands, NULL);
+            cJSON *json = redisDS_read(name, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            cJSON_Delete(json);
+            redisDS_sync(name);
+            resp_server_stats(server, &sent, NULL);
+            CU_ASSERT_EQUAL(sent - commands, 3);
+
+            // the interval alone is kept without a flusher until the sliding is set
+            char other[64];
+            snprintf(other, sizeof(other), "%s_interval", name);
+            CU_ASSERT_EQUAL_FATAL(redisDS_register(other, database, "%s", prefix), 1);
+            CU_ASSERT_EQUAL(redisDS_option(other, REDIS_DS_SLIDING_INTERVAL, 0), 1);
+            resp_server_stats(server, &commands, NULL);
+            json = redisDS_read(other, "%s", key);
+            CU_ASSERT_PTR_NOT_NULL(json);
+            cJSON_Delete(json);
+            CU_ASSERT_EQUAL(redisDS_sync(other), 1);
+            resp_server_stats(server, &sent, NULL);
+            CU_ASSERT_EQUAL(sent - commands, 2);
+
+            CU_ASSERT_EQUAL(redisDS_option(other, REDIS_DS_SLIDING, 10 * ttl), 1);
+            resp_server_stats(server, &commands, NULL);
+            for (int i = 0; i < 2; i++)
+            {
+                json = redisDS_read(other, "%s", key);
+                CU_ASSERT_PTR_NOT_NULL(json);
+                cJSON_Delete(json);
+            }
+            redisDS_sync(other);
+            resp_server_stats(server, &sent, NULL);
+            CU_ASSERT_EQUAL(sent - commands, 2 * 2 + 1 + 2);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(key);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+    resp_server_stop(server);
+}
+
+static void test_sharding(void)
+{
+    printf("\n%s\n", __func__);
+
+    resp_server *servers[3];
+    for (int i = 0; i < 3; i++)
+    {
+        servers[i] = resp_server_start(0, auth);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(servers[i]);
+    }
+    CU_ASSERT_EQUAL_FATAL(redisDS_serverAdd("127.0.0.1", resp_server_port(servers[0]), auth, timeout, 1), 1);
+    CU_ASSERT_EQUAL_FATAL(redisDS_serverAdd("127.0.0.1", resp_server_port(servers[1]), auth, timeout, 1), 1);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int keys = 0;
+        char *value = NULL;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %ms", &dataset, &database, &prefix, &keys, &value);
+        // +code
+        {
+            char *name = '@' == dataset[0] ? dataset + 1 : dataset;
+            int reg = redisDS_register(name, database, "%s", prefix);
+            CU_ASSERT_EQUAL_FATAL(reg, 1);
+
+            cJSON *object = cJSON_CreateObject();
+            for (int i = 0; i < keys; i++)
+            {
+                char key[32];
+                snprintf(key, sizeof(key), "shard:%d", i);
+                cJSON_AddStringToObject(object, key, value);
+            }
+
+            // SET + EXPIRE per key, every server gets its part
+            long long before[3], after[3];
+            for (int i = 0; i < 3; i++)
+            {
+                resp_server_stats(servers[i], &before[i], NULL);
+            }
+            CU_ASSERT_EQUAL(redisDS_store(name, object, ttl), keys);
+            for (int i = 0; i < 3; i++)
+            {
+                resp_server_stats(servers[i], &after[i], NULL);
+            }
+            printf("%s %lld+%lld commands\n", name, after[0] - before[0], after[1] - before[1]);
+            CU_ASSERT(after[0] - before[0] > 0);
+            CU_ASSERT(after[1] - before[1] > 0);
+            CU_ASSERT_EQUAL(after[0] - before[0] + after[1] - before[1], 2 * keys);
+
+            // every key is read back from the server it was written to
+            for (int i = 0; i < keys; i++)
+            {
+                cJSON *json = redisDS_read(name, "shard:%d", i);
+                CU_ASSERT_PTR_NOT_NULL(json);
+                cJSON_Delete(json);
+            }
+
+            // the third server takes about a third of the keys, the others stay in place
+            CU_ASSERT_EQUAL_FATAL(redisDS_serverAdd("127.0.0.1", resp_server_port(servers[2]), auth, timeout, 1), 1);
+            int moved = 0;
+            for (int i = 0; i < keys; i++)
+            {
+                cJSON *json = redisDS_read(name, "shard:%d", i);
+                moved += (NULL == json);
+                cJSON_Delete(json);
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                resp_server_stats(servers[i], &before[i], NULL);
+            }
+            CU_ASSERT_EQUAL(redisDS_store(name, object, ttl), keys);
+            for (int i = 0; i < 3; i++)
+            {
+                resp_server_stats(servers[i], &after[i], NULL);
+            }
+            printf("%s %d of %d keys moved\n", name, moved, keys);
+            CU_ASSERT(moved > keys / 5 && moved < keys / 2);
+            CU_ASSERT_EQUAL(after[2] - before[2], 2 * moved);
+            cJSON_Delete(object);
+        }
+        // -code
+        FREE_AND_NULL(value);
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+
+    redisDS_serverClose();
+    for (int i = 0; i < 3; i++)
+    {
+        resp_server_stop(servers[i]);
+    }
+}
+
+static void test_tool(void)
+{
+    printf("\n%s\n", __func__);
+
+    START_USING_TEST_DATA("data/")
+    {
+        char *dataset = NULL;
+        int database = 0;
+        char *prefix = NULL;
+        int keys = 0;
+        int members = 0;
+        USE_OF_THE_TEST_DATA("%m[^ :] : %d = %ms %d %d", &dataset, &database, &prefix, &keys, &members);
+        // +code
+        {
+            char command[512];
+            snprintf(command, sizeof(command), "%s import -h %s -p %d -n %d -x %s -c 4 -t %lld -f ndjson",
+                     tool, host, port, database, prefix, ttl);
+            FILE *input = popen(command, "w");
+            CU_ASSERT_PTR_NOT_NULL_FATAL(input);
+
+            // the list spans several commands and batches, the repeated key keeps its last record
+            fprintf(input, "{\"key\":\"repeated\",\"type\":\"list\",\"value\":[\"first\"]}\n");
+            fprintf(input, "{\"key\":\"list\",\"type\":\"list\",\"ttl\":60000,\"value\":[");
+            for (int i = 0; i < members; i++)
+            {
+                fprintf(input, "%s\"%d\"", i ? "," : "", i);
+            }
+            fprintf(input, "]}\n");
+            for (int i = 0; i < keys; i++)
+            {
+                fprintf(input, "{\"key\":\"hash:%d\",\"value\":{\"field\":\"%d\"}}\n", i, i);
+            }
+            fprintf(input, "{\"key\":\"repeated\",\"value\":\"last\"}\n");
+            CU_ASSERT_EQUAL(pclose(input), 0);
+
+            snprintf(command, sizeof(command), "%s export -h %s -p %d -n %d -x %s", tool, host, port, database, prefix);
+            FILE *output = popen(command, "r");
+            CU_ASSERT_PTR_NOT_NULL_FATAL(output);
+
+            int exported = 0;
+            int hashes = 0;
+            char *line = NULL;
+            size_t size = 0;
+            while (getline(&line, &size, output) >= 0)
+            {
+                cJSON *record = cJSON_Parse(line);
+                CU_ASSERT_PTR_NOT_NULL_FATAL(record);
+                char *key = cJSON_GetStringValue(cJSON_GetObjectItem(record, "key"));
+                cJSON *value = cJSON_GetObjectItem(record, "value");
+                CU_ASSERT_PTR_NOT_NULL_FATAL(key);
+                if (!strcmp(key, "list"))
+                {
+                    CU_ASSERT_EQUAL(cJSON_GetArraySize(value), members);
+                    int ordered = 1;
+                    for (int i = 0; ordered && i < cJSON_GetArraySize(value); i++)
+                    {
+                        ordered = (atoi(cJSON_GetStringValue(cJSON_GetArrayItem(value, i))) == i);
+                    }
+                    CU_ASSERT(ordered);
+                    CU_ASSERT(cJSON_GetNumberValue(cJSON_GetObjectItem(record, "ttl")) > 1000 * ttl);
+                }
+                else if (!strcmp(key, "repeated"))
+                {
+                    CU_ASSERT_STRING_EQUAL(cJSON_GetStringValue(value), "last");
+                }
+                else
+                {
+                    int index = -1;
+                    CU_ASSERT_EQUAL(sscanf(key, "hash:%d", &index), 1);
+                    CU_ASSERT_EQUAL(atoi(cJSON_GetStringValue(cJSON_GetObjectItem(value, "field"))), index);
+                    hashes++;
+                }
+                exported++;
+                cJSON_Delete(record);
+            }
+            FREE_AND_NULL(line);
+            CU_ASSERT_EQUAL(pclose(output), 0);
+            printf("%s %d records, %d hashes\n", dataset, exported, hashes);
+            CU_ASSERT_EQUAL(hashes, keys);
+            CU_ASSERT_EQUAL(exported, keys + 2);
+        }
+        // -code
+        FREE_AND_NULL(prefix);
+        FREE_AND_NULL(dataset);
+    }
+    FINISH_USING_TEST_DATA;
+}
+
+/**
+ * Deactivates the tests that need the Redis server or the tool when they are missing,
+ * CUnit reports them as inactive instead of passed
+ *
+ * @param suite of the testing actions
+ */
+void testing_actions_check(CU_pSuite suite)
+{
+    static const char *needs_redis[] = {"(test_cache)", "(test_approximate)", "(test_buckets)", "(test_migrate)",
+                                        "(test_memory)", "(test_ratelimit)", "(test_tool)", NULL};
+    int available = redis_available();
+    for (int i = 0; needs_redis[i]; i++)
+    {
+        int built = strcmp(needs_redis[i], "(test_tool)") || !access(tool, X_OK);
+        if (!available || !built)
+        {
+            printf("%s is inactive: %s\n", needs_redis[i], available ? "the tool is not built" : "no Redis server");
+            CU_set_test_active(CU_get_test(suite, needs_redis[i]), CU_FALSE);
+        }
+    }
+}
+
 CU_TestInfo testing_actions[] =
     {
         {"(test_store)", test_store},
-        // {"(test_read)", test_read},
-        // {"(test_set)", test_set},
+        {"(test_read)", test_read},
+        {"(test_set)", test_set},
         // {"(test_append)", test_append},
-        // {"(test_increment)", test_increment},
+        {"(test_increment)", test_increment},
+        {"(test_cache)", test_cache},
+        {"(test_approximate)", test_approximate},
+        {"(test_buckets)", test_buckets},
+        {"(test_deadline)", test_deadline},
+        {"(test_migrate)", test_migrate},
+        {"(test_hotkeys)", test_hotkeys},
+        {"(test_memory)", test_memory},
+        {"(test_standin)", test_standin},
+        {"(test_ratelimit)", test_ratelimit},
+        {"(test_push)", test_push},
+        {"(test_sliding)", test_sliding},
+        {"(test_hedge)", test_hedge},
+        {"(test_setmany)", test_setmany},
+        {"(test_sharding)", test_sharding},
+        {"(test_tool)", test_tool},
         // {"(test_check)", test_check},
         CU_TEST_INFO_NULL,
 };
@@ -0,0 +1,1183 @@
+/**
+ * redisds-tool: bulk import/export of dataspaces
+ *
+ * import: streams a JSON object {"key": value, ...}, a JSON array of records
+ *         or NDJSON records into pipelined RESP over parallel connections, a key always uses the same one
+ * export: walks the prefix with SCAN MATCH and streams NDJSON records
+ * migrate: moves the dataspace to another base, prefix or server by redisDS_migrate()
+ *
+ * record: {"key":"name without prefix","type":"string|set|hash|list","ttl":ms,"value":...}
+ */
+#include <redisds/redis_ds.h>
+#include <cjson/cJSON.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VERSION
+#define VERSION "0"
+#endif
+
+#define TOOL_BATCH 1000 // commands per pipeline
+#define TOOL_CHUNK 512  // members per SADD/HSET/RPUSH
+#define TOOL_SCAN 1000  // SCAN COUNT hint
+
+#define FREE_REPLY(x)       \
+    if (x)                  \
+    {                       \
+        freeReplyObject(x); \
+        x = NULL;           \
+    }
+
+typedef struct tool_options
+{
+    char *host;
+    int port;
+    char *auth;
+    int base;
+    char *prefix;
+    int connections;
+    long long ttl; // seconds, for records without ttl
+    int ndjson;    // import format
+    redis_server target;
+    int target_base;
+    char *target_prefix;
+    long long rate; // migrated keys per second
+    int move;       // the migrated source keys are deleted
+} tool_options;
+
+/**
+ * Formatted commands written as one pipeline
+ */
+typedef struct tool_batch
+{
+    struct tool_batch *next;
+    int count;
+    char *commands[TOOL_BATCH];
+    long long lengths[TOOL_BATCH];
+} tool_batch;
+
+/**
+ * Bounded queue of batches of one connection
+ */
+typedef struct tool_queue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    tool_batch *head;
+    tool_batch *tail;
+    int size;
+    int limit;
+    int closed;
+} tool_queue;
+
+/**
+ * Connection with its own queue, a key always goes to the same connection,
+ * so the commands of a key run in the input order
+ */
+typedef struct tool_worker
+{
+    pthread_t thread;
+    tool_options *options;
+    tool_queue queue;
+    tool_batch *batch; // being filled by the importer
+    long long commands;
+    long long errors;
+} tool_worker;
+
+typedef struct tool_importer
+{
+    tool_options *options;
+    tool_worker *workers;
+    long long records;
+} tool_importer;
+
+/**
+ * Growable text buffer
+ */
+typedef struct tool_text
+{
+    char *data;
+    size_t length;
+    size_t size;
+} tool_text;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// connection
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Connects, authenticates and selects the base
+ *
+ * @param options
+ * @return redisContext* | NULL
+ */
+static redisContext *tool_connect(tool_options *options)
+{
+    redisContext *redis = redisConnect(options->host, options->port);
+    if (!redis || redis->err)
+    {
+        fprintf(stderr, "CONNECT %s:%d: %s\n", options->host, options->port, redis ? redis->errstr : "no memory");
+        if (redis)
+        {
+            redisFree(redis);
+        }
+        return NULL;
+    }
+
+    redisReply *reply = NULL;
+    if (options->auth && options->auth[0])
+    {
+        reply = redisCommand(redis, "AUTH %s", options->auth);
+        if (!reply || REDIS_REPLY_ERROR == reply->type)
+        {
+            fprintf(stderr, "AUTH: %s\n", reply ? reply->str : redis->errstr);
+            FREE_REPLY(reply);
+            redisFree(redis);
+            return NULL;
+        }
+        FREE_REPLY(reply);
+    }
+
+    reply = redisCommand(redis, "SELECT %d", options->base);
+    if (!reply || REDIS_REPLY_ERROR == reply->type)
+    {
+        fprintf(stderr, "SELECT %d: %s\n", options->base, reply ? reply->str : redis->errstr);
+        FREE_REPLY(reply);
+        redisFree(redis);
+        return NULL;
+    }
+    FREE_REPLY(reply);
+
+    return redis;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// batch queue
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void tool_queue_init(tool_queue *queue, int limit)
+{
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+    pthread_cond_init(&queue->space, NULL);
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->size = 0;
+    queue->limit = limit;
+    queue->closed = 0;
+}
+
+static void tool_queue_destroy(tool_queue *queue)
+{
+    pthread_cond_destroy(&queue->space);
+    pthread_cond_destroy(&queue->ready);
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+/**
+ * Queues the batch, waits while the queue is full
+ *
+ * @param queue
+ * @param batch
+ */
+static void tool_queue_push(tool_queue *queue, tool_batch *batch)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->size >= queue->limit)
+    {
+        pthread_cond_wait(&queue->space, &queue->mutex);
+    }
+    batch->next = NULL;
+    if (queue->tail)
+    {
+        queue->tail->next = batch;
+    }
+    else
+    {
+        queue->head = batch;
+    }
+    queue->tail = batch;
+    queue->size++;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Takes the next batch, waits while the queue is empty and open
+ *
+ * @param queue
+ * @return tool_batch* | NULL closed and empty
+ */
+static tool_batch *tool_queue_pop(tool_queue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (!queue->head && !queue->closed)
+    {
+        pthread_cond_wait(&queue->ready, &queue->mutex);
+    }
+    tool_batch *batch = queue->head;
+    if (batch)
+    {
+        queue->head = batch->next;
+        if (!queue->head)
+        {
+            queue->tail = NULL;
+        }
+        queue->size--;
+        pthread_cond_signal(&queue->space);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return batch;
+}
+
+static void tool_queue_close(tool_queue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void tool_batch_free(tool_batch *batch)
+{
+    for (int i = 0; i < batch->count; i++)
+    {
+        redisFreeCommand(batch->commands[i]);
+    }
+    free(batch);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// import
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Connection thread: writes each batch as one pipeline and reads its replies
+ *
+ * @param arg worker
+ * @return void*
+ */
+static void *tool_worker_thread(void *arg)
+{
+    tool_worker *worker = arg;
+    redisContext *redis = tool_connect(worker->options);
+
+    tool_batch *batch = NULL;
+    while ((batch = tool_queue_pop(&worker->queue)))
+    {
+        int done = 0;
+        for (int attempt = 0; attempt < 2 && done < batch->count; attempt++)
+        {
+            if (!redis && !(redis = tool_connect(worker->options)))
+            {
+                break;
+            }
+            for (int i = done; i < batch->count; i++)
+            {
+                redisAppendFormattedCommand(redis, batch->commands[i], batch->lengths[i]);
+            }
+            for (; done < batch->count; done++)
+            {
+                redisReply *reply = NULL;
+                if (REDIS_OK != redisGetReply(redis, (void **)&reply))
+                {
+                    fprintf(stderr, "PIPELINE: %s\n", redis->errstr);
+                    redisFree(redis);
+                    redis = NULL;
+                    break;
+                }
+                if (REDIS_REPLY_ERROR == reply->type)
+                {
+                    fprintf(stderr, "REPLY: %s\n", reply->str);
+                    worker->errors++;
+                }
+                FREE_REPLY(reply);
+            }
+        }
+        worker->commands += done;
+        worker->errors += batch->count - done;
+        tool_batch_free(batch);
+    }
+
+    if (redis)
+    {
+        redisFree(redis);
+    }
+    return NULL;
+}
+
+/**
+ * Picks the connection of the key by its FNV-1a hash
+ *
+ * @param importer
+ * @param key with prefix
+ * @return tool_worker*
+ */
+static tool_worker *tool_import_worker(tool_importer *importer, const char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *ptr = (const unsigned char *)key; *ptr; ptr++)
+    {
+        hash = (hash ^ *ptr) * 16777619u;
+    }
+    return &importer->workers[hash % (uint32_t)importer->options->connections];
+}
+
+/**
+ * Formats the command into the current batch of the connection, the full batch is queued
+ *
+ * @param worker
+ * @param argc
+ * @param argv
+ * @param argvlen
+ * @return int 1 | 0
+ */
+static int tool_import_command(tool_worker *worker, int argc, const char **argv, const size_t *argvlen)
+{
+    if (!worker->batch && !(worker->batch = calloc(1, sizeof(tool_batch))))
+    {
+        return 0;
+    }
+
+    tool_batch *batch = worker->batch;
+    long long length = redisFormatCommandArgv(&batch->commands[batch->count], argc, argv, argvlen);
+    if (length < 0)
+    {
+        return 0;
+    }
+    batch->lengths[batch->count++] = length;
+
+    if (TOOL_BATCH == batch->count)
+    {
+        tool_queue_push(&worker->queue, batch);
+        worker->batch = NULL;
+    }
+    return 1;
+}
+
+/**
+ * Writes the scalar in the form redisDS_read() returns it
+ *
+ * @param item
+ * @param buffer
+ * @param size
+ * @return const char* | NULL for containers
+ */
+static const char *tool_scalar(cJSON *item, char *buffer, size_t size)
+{
+    if (cJSON_IsString(item))
+    {
+        return item->valuestring;
+    }
+    if (cJSON_IsNumber(item))
+    {
+        double value = item->valuedouble;
+        if (value == (double)(long long)value)
+        {
+            snprintf(buffer, size, "%lld", (long long)value);
+        }
+        else
+        {
+            snprintf(buffer, size, "%.17g", value);
+        }
+        return buffer;
+    }
+    if (cJSON_IsBool(item))
+    {
+        return cJSON_IsTrue(item) ? "1" : "0";
+    }
+    return NULL;
+}
+
+/**
+ * Sends the members of the container in chunks: "command key member..." or "command key field value..."
+ *
+ * @param worker connection of the key
+ * @param command
+ * @param key
+ * @param value
+ * @param pairs hash fields
+ * @return int 1 | 0
+ */
+static int tool_import_members(tool_worker *worker, const char *command, const char *key, cJSON *value, int pairs)
+{
+    const char *argv[2 + 2 * TOOL_CHUNK];
+    size_t argvlen[2 + 2 * TOOL_CHUNK];
+    char numbers[2 * TOOL_CHUNK][32];
+
+    argv[0] = command;
+    argvlen[0] = strlen(command);
+    argv[1] = key;
+    argvlen[1] = strlen(key);
+
+    int argc = 2;
+    int ok = 1;
+    cJSON *element = NULL;
+    cJSON_ArrayForEach(element, value)
+    {
+        const char *scalar = tool_scalar(element, numbers[argc - 2], sizeof(numbers[0]));
+        if (!scalar)
+        {
+            continue;
+        }
+        if (pairs)
+        {
+            argv[argc] = element->string;
+            argvlen[argc++] = strlen(element->string);
+        }
+        argv[argc] = scalar;
+        argvlen[argc++] = strlen(scalar);
+
+        if (argc >= 2 + 2 * TOOL_CHUNK - 1)
+        {
+            ok = ok && tool_import_command(worker, argc, argv, argvlen);
+            argc = 2;
+        }
+    }
+    if (argc > 2)
+    {
+        ok = ok && tool_import_command(worker, argc, argv, argvlen);
+    }
+    return ok;
+}
+
+/**
+ * Imports one key: the containers are replaced, not merged.
+ * All commands of the key go to its connection.
+ *
+ * @param importer
+ * @param key without prefix
+ * @param type string | set | hash | list | NULL by the value
+ * @param value
+ * @param ttl milliseconds, <= 0 for the default
+ * @return int 1 | 0
+ */
+static int tool_import_record(tool_importer *importer, const char *key, const char *type, cJSON *value, long long ttl)
+{
+    tool_options *options = importer->options;
+    if (!key || !value)
+    {
+        return 0;
+    }
+
+    size_t length = strlen(options->prefix) + strlen(key);
+    char *fullkey = malloc(length + 1);
+    if (!fullkey)
+    {
+        return 0;
+    }
+    strcpy(fullkey, options->prefix);
+    strcat(fullkey, key);
+    tool_worker *worker = tool_import_worker(importer, fullkey);
+
+    int ok = 1;
+    char number[32];
+    const char *scalar = tool_scalar(value, number, sizeof(number));
+    if (scalar)
+    {
+        const char *argv[] = {"SET", fullkey, scalar};
+        size_t argvlen[] = {3, length, strlen(scalar)};
+        ok = tool_import_command(worker, 3, argv, argvlen);
+    }
+    else if (cJSON_IsArray(value) || cJSON_IsObject(value))
+    {
+        const char *argv[] = {"DEL", fullkey};
+        size_t argvlen[] = {3, length};
+        ok = tool_import_command(worker, 2, argv, argvlen);
+
+        if (cJSON_IsObject(value))
+        {
+            ok = ok && tool_import_members(worker, "HSET", fullkey, value, 1);
+        }
+        else if (type && !strcmp(type, "list"))
+        {
+            ok = ok && tool_import_members(worker, "RPUSH", fullkey, value, 0);
+        }
+        else
+        {
+            ok = ok && tool_import_members(worker, "SADD", fullkey, value, 0);
+        }
+    }
+    else
+    {
+        ok = 0;
+    }
+
+    if (ok && (ttl > 0 || options->ttl > 0))
+    {
+        char expire[32];
+        snprintf(expire, sizeof(expire), "%lld", ttl > 0 ? ttl : options->ttl * 1000);
+        const char *argv[] = {"PEXPIRE", fullkey, expire};
+        size_t argvlen[] = {7, length, strlen(expire)};
+        ok = tool_import_command(worker, 3, argv, argvlen);
+    }
+
+    if (ok)
+    {
+        importer->records++;
+    }
+    free(fullkey);
+    return ok;
+}
+
+/**
+ * Imports the NDJSON record or the record of the JSON array
+ *
+ * @param importer
+ * @param record
+ * @return int 1 | 0
+ */
+static int tool_import_object(tool_importer *importer, cJSON *record)
+{
+    cJSON *key = cJSON_GetObjectItemCaseSensitive(record, "key");
+    cJSON *type = cJSON_GetObjectItemCaseSensitive(record, "type");
+    cJSON *ttl = cJSON_GetObjectItemCaseSensitive(record, "ttl");
+    cJSON *value = cJSON_GetObjectItemCaseSensitive(record, "value");
+    if (!cJSON_IsString(key))
+    {
+        return 0;
+    }
+    return tool_import_record(importer,
+                              key->valuestring,
+                              cJSON_IsString(type) ? type->valuestring : NULL,
+                              value,
+                              cJSON_IsNumber(ttl) ? (long long)ttl->valuedouble : 0);
+}
+
+static int tool_text_add(tool_text *text, int c)
+{
+    if (text->length + 1 >= text->size)
+    {
+        size_t size = text->size ? text->size * 2 : 4096;
+        char *data = realloc(text->data, size);
+        if (!data)
+        {
+            return 0;
+        }
+        text->data = data;
+        text->size = size;
+    }
+    text->data[text->length++] = (char)c;
+    text->data[text->length] = 0;
+    return 1;
+}
+
+static int tool_skip_space(FILE *input)
+{
+    int c = 0;
+    while (EOF != (c = getc(input)) && isspace(c))
+    {
+    }
+    return c;
+}
+
+/**
+ * Reads the text of one JSON value, the memory is bound by the largest value.
+ * Stops after the value, before the separator at the depth 0.
+ *
+ * @param input
+ * @param first character of the value
+ * @param text
+ * @return int 1 | 0
+ */
+static int tool_read_value(FILE *input, int first, tool_text *text)
+{
+    text->length = 0;
+    int depth = 0;
+    int string = 0;
+    int escape = 0;
+    int c = first;
+    for (; EOF != c; c = getc(input))
+    {
+        if (!string && !depth && text->length && (',' == c || '}' == c || ']' == c || isspace(c)))
+        {
+            ungetc(c, input);
+            return 1;
+        }
+        if (!tool_text_add(text, c))
+        {
+            return 0;
+        }
+        if (string)
+        {
+            if (escape)
+            {
+                escape = 0;
+            }
+            else if ('\\' == c)
+            {
+                escape = 1;
+            }
+            else if ('"' == c)
+            {
+                string = 0;
+                if (!depth)
+                {
+                    return 1;
+                }
+            }
+        }
+        else if ('"' == c)
+        {
+            string = 1;
+        }
+        else if ('{' == c || '[' == c)
+        {
+            depth++;
+        }
+        else if ('}' == c || ']' == c)
+        {
+            if (!--depth)
+            {
+                return 1;
+            }
+        }
+    }
+    return text->length && !depth && !string;
+}
+
+/**
+ * Streams the members of the top-level object or array
+ *
+ * @param importer
+ * @param input
+ * @param open '{' | '['
+ * @return long long malformed members
+ */
+static long long tool_import_json(tool_importer *importer, FILE *input, int open)
+{
+    long long errors = 0;
+    tool_text key = {NULL, 0, 0};
+    tool_text value = {NULL, 0, 0};
+    int close = ('{' == open) ? '}' : ']';
+
+    int c = tool_skip_space(input);
+    while (EOF != c && close != c)
+    {
+        cJSON *name = NULL;
+        if ('{' == open)
+        {
+            // "key" :
+            if (!tool_read_value(input, c, &key) || !(name = cJSON_Parse(key.data)) || !cJSON_IsString(name) ||
+                ':' != tool_skip_space(input))
+            {
+                cJSON_Delete(name);
+                errors++;
+                break;
+            }
+            c = tool_skip_space(input);
+        }
+
+        cJSON *item = NULL;
+        if (!tool_read_value(input, c, &value) || !(item = cJSON_Parse(value.data)))
+        {
+            cJSON_Delete(name);
+            errors++;
+            break;
+        }
+        int ok = name ? tool_import_record(importer, name->valuestring, NULL, item, 0) : tool_import_object(importer, item);
+        if (!ok)
+        {
+            errors++;
+        }
+        cJSON_Delete(item);
+        cJSON_Delete(name);
+
+        c = tool_skip_space(input);
+        if (',' == c)
+        {
+            c = tool_skip_space(input);
+        }
+    }
+
+    FREE_AND_NULL(key.data);
+    FREE_AND_NULL(value.data);
+    return errors;
+}
+
+/**
+ * Streams NDJSON records line by line
+ *
+ * @param importer
+ * @param input
+ * @return long long malformed lines
+ */
+static long long tool_import_lines(tool_importer *importer, FILE *input)
+{
+    long long errors = 0;
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, input) >= 0)
+    {
+        char *ptr = line;
+        while (isspace((unsigned char)*ptr))
+        {
+            ptr++;
+        }
+        if (!*ptr)
+        {
+            continue;
+        }
+        cJSON *record = cJSON_Parse(ptr);
+        if (!record || !tool_import_object(importer, record))
+        {
+            errors++;
+        }
+        cJSON_Delete(record);
+    }
+    FREE_AND_NULL(line);
+    return errors;
+}
+
+/**
+ * Imports the file: the JSON object or array of records, or NDJSON records
+ *
+ * @param options
+ * @param input
+ * @return int exit code
+ */
+static int tool_import(tool_options *options, FILE *input)
+{
+    tool_worker *workers = calloc(options->connections, sizeof(tool_worker));
+    if (!workers)
+    {
+        return 1;
+    }
+    tool_importer importer;
+    importer.options = options;
+    importer.workers = workers;
+    importer.records = 0;
+    for (int i = 0; i < options->connections; i++)
+    {
+        workers[i].options = options;
+        tool_queue_init(&workers[i].queue, 2);
+        pthread_create(&workers[i].thread, NULL, tool_worker_thread, &workers[i]);
+    }
+
+    long long malformed = 0;
+    int c = 0;
+    if (options->ndjson)
+    {
+        malformed = tool_import_lines(&importer, input);
+    }
+    else if ('{' == (c = tool_skip_space(input)) || '[' == c)
+    {
+        malformed = tool_import_json(&importer, input, c);
+    }
+    else if (EOF != c)
+    {
+        malformed++;
+    }
+
+    for (int i = 0; i < options->connections; i++)
+    {
+        if (workers[i].batch)
+        {
+            tool_queue_push(&workers[i].queue, workers[i].batch);
+            workers[i].batch = NULL;
+        }
+        tool_queue_close(&workers[i].queue);
+    }
+
+    long long commands = 0;
+    long long errors = 0;
+    for (int i = 0; i < options->connections; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        commands += workers[i].commands;
+        errors += workers[i].errors;
+        tool_queue_destroy(&workers[i].queue);
+    }
+    free(workers);
+
+    fprintf(stderr, "imported %lld keys, %lld commands, %lld errors, %lld malformed\n",
+            importer.records, commands, errors, malformed);
+    return (errors || malformed) ? 1 : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// export
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Escapes the glob characters of the prefix for SCAN MATCH
+ *
+ * @param prefix
+ * @return char* prefix*
+ */
+static char *tool_pattern(const char *prefix)
+{
+    char *pattern = malloc(2 * strlen(prefix) + 2);
+    if (pattern)
+    {
+        char *ptr = pattern;
+        for (; *prefix; prefix++)
+        {
+            if (strchr("*?[]\\", *prefix))
+            {
+                *ptr++ = '\\';
+            }
+            *ptr++ = *prefix;
+        }
+        *ptr++ = '*';
+        *ptr = 0;
+    }
+    return pattern;
+}
+
+/**
+ * Converts the value reply of the type to JSON
+ *
+ * @param type
+ * @param reply
+ * @return cJSON*
+ */
+static cJSON *tool_value(const char *type, redisReply *reply)
+{
+    cJSON *json = NULL;
+    if (!reply)
+    {
+        return NULL;
+    }
+    if (!strcmp(type, "string") && REDIS_REPLY_STRING == reply->type)
+    {
+        json = cJSON_CreateString(reply->str);
+    }
+    else if (!strcmp(type, "hash") && REDIS_REPLY_ARRAY == reply->type && (json = cJSON_CreateObject()))
+    {
+        for (size_t i = 0; i + 1 < reply->elements; i += 2)
+        {
+            cJSON_AddStringToObject(json, reply->element[i]->str, reply->element[i + 1]->str);
+        }
+    }
+    else if ((!strcmp(type, "set") || !strcmp(type, "list")) && REDIS_REPLY_ARRAY == reply->type && (json = cJSON_CreateArray()))
+    {
+        for (size_t i = 0; i < reply->elements; i++)
+        {
+            cJSON_AddItemToArray(json, cJSON_CreateString(reply->element[i]->str));
+        }
+    }
+    return json;
+}
+
+/**
+ * Exports the keys of one SCAN step: TYPE and PTTL, then the values, in two pipelines
+ *
+ * @param redis
+ * @param keys
+ * @param skip prefix length
+ * @param output
+ * @param exported
+ * @return int 1 | 0 connection lost
+ */
+static int tool_export_keys(redisContext *redis, redisReply *keys, size_t skip, FILE *output, long long *exported)
+{
+    size_t count = keys->elements;
+    redisReply **types = calloc(2 * count + 1, sizeof(redisReply *));
+    if (!types)
+    {
+        return 0;
+    }
+    redisReply **ttls = types + count;
+
+    int ok = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        redisAppendCommand(redis, "TYPE %b", keys->element[i]->str, keys->element[i]->len);
+        redisAppendCommand(redis, "PTTL %b", keys->element[i]->str, keys->element[i]->len);
+    }
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        ok = (REDIS_OK == redisGetReply(redis, (void **)&types[i])) &&
+             (REDIS_OK == redisGetReply(redis, (void **)&ttls[i]));
+    }
+
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        const char *type = types[i] ? types[i]->str : "none";
+        const char *key = keys->element[i]->str;
+        size_t length = keys->element[i]->len;
+        if (!strcmp(type, "string"))
+        {
+            redisAppendCommand(redis, "GET %b", key, length);
+        }
+        else if (!strcmp(type, "hash"))
+        {
+            redisAppendCommand(redis, "HGETALL %b", key, length);
+        }
+        else if (!strcmp(type, "set"))
+        {
+            redisAppendCommand(redis, "SMEMBERS %b", key, length);
+        }
+        else if (!strcmp(type, "list"))
+        {
+            redisAppendCommand(redis, "LRANGE %b 0 -1", key, length);
+        }
+    }
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        const char *type = types[i] ? types[i]->str : "none";
+        if (strcmp(type, "string") && strcmp(type, "hash") && strcmp(type, "set") && strcmp(type, "list"))
+        {
+            // expired meanwhile or not a dataspace type
+            continue;
+        }
+
+        redisReply *reply = NULL;
+        if (REDIS_OK != redisGetReply(redis, (void **)&reply))
+        {
+            ok = 0;
+            break;
+        }
+
+        cJSON *value = tool_value(type, reply);
+        cJSON *record = value ? cJSON_CreateObject() : NULL;
+        if (record)
+        {
+            cJSON_AddStringToObject(record, "key", keys->element[i]->str + skip);
+            cJSON_AddStringToObject(record, "type", type);
+            cJSON_AddNumberToObject(record, "ttl", (ttls[i] && ttls[i]->integer > 0) ? (double)ttls[i]->integer : -1);
+            cJSON_AddItemToObject(record, "value", value);
+            value = NULL;
+
+            char *line = cJSON_PrintUnformatted(record);
+            if (line)
+            {
+                fputs(line, output);
+                fputc('\n', output);
+                free(line);
+                (*exported)++;
+            }
+            cJSON_Delete(record);
+        }
+        cJSON_Delete(value);
+        FREE_REPLY(reply);
+    }
+
+    for (size_t i = 0; i < 2 * count; i++)
+    {
+        FREE_REPLY(types[i]);
+    }
+    free(types);
+    return ok;
+}
+
+/**
+ * Streams the keys of the prefix as NDJSON
+ *
+ * @param options
+ * @param output
+ * @return int exit code
+ */
+static int tool_export(tool_options *options, FILE *output)
+{
+    redisContext *redis = tool_connect(options);
+    char *pattern = tool_pattern(options->prefix);
+    if (!redis || !pattern)
+    {
+        FREE_AND_NULL(pattern);
+        if (redis)
+        {
+            redisFree(redis);
+        }
+        return 1;
+    }
+
+    long long exported = 0;
+    int ok = 1;
+    char cursor[32] = "0";
+    do
+    {
+        redisReply *reply = redisCommand(redis, "SCAN %s MATCH %s COUNT %d", cursor, pattern, TOOL_SCAN);
+        if (!reply || REDIS_REPLY_ARRAY != reply->type || 2 != reply->elements)
+        {
+            fprintf(stderr, "SCAN: %s\n", reply ? reply->str : redis->errstr);
+            FREE_REPLY(reply);
+            ok = 0;
+            break;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        ok = tool_export_keys(redis, reply->element[1], strlen(options->prefix), output, &exported);
+        FREE_REPLY(reply);
+    } while (ok && strcmp(cursor, "0"));
+
+    fflush(output);
+    fprintf(stderr, "exported %lld keys\n", exported);
+
+    free(pattern);
+    redisFree(redis);
+    return ok ? 0 : 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// migrate
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void tool_progress(const redis_migration *migration, void *arg)
+{
+    (void)arg;
+    fprintf(stderr, "\rscanned %lld, moved %lld, failed %lld, removed %lld, %.1fs, %.0f keys/s",
+            migration->scanned, migration->moved, migration->failed, migration->removed, migration->elapsed, migration->rate);
+}
+
+/**
+ * Moves the dataspace, the library does the work
+ *
+ * @param options
+ * @return int exit code
+ */
+static int tool_migrate(tool_options *options)
+{
+    redis_server *target = &options->target;
+    int remote = target->host && (strcmp(target->host, options->host) || (target->port != options->port));
+    if (!redisDS_serverOpen(options->host, options->port, options->auth, 0) ||
+        !redisDS_register("migrate", options->base, "%s", options->prefix) ||
+        !redisDS_option("migrate", REDIS_DS_MIGRATE_DELETE, options->move))
+    {
+        fprintf(stderr, "OPEN %s:%d: %s\n", options->host, options->port, strerror(errno));
+        return 1;
+    }
+    // the target is added before the migration, out of the ring
+    if (remote && !redisDS_serverAdd(target->host, target->port, target->auth, 0, 0))
+    {
+        fprintf(stderr, "OPEN %s:%d: %s\n", target->host, target->port, strerror(errno));
+        redisDS_serverClose();
+        return 1;
+    }
+
+    int ok = redisDS_migrate("migrate",
+                             target->host ? target : NULL,
+                             options->target_base,
+                             options->target_prefix,
+                             options->connections,
+                             options->rate,
+                             tool_progress,
+                             NULL);
+    fprintf(stderr, "\n%s\n", ok ? "done" : strerror(errno));
+
+    redisDS_serverClose();
+    return ok ? 0 : 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// main
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void tool_usage(const char *name)
+{
+    fprintf(stderr,
+            "redisds-tool %s\n"
+            "usage: %s import|export|migrate [options] [file]\n"
+            "  -h host          (localhost)\n"
+            "  -p port          (6379)\n"
+            "  -a auth\n"
+            "  -n base          (0)\n"
+            "  -x prefix        dataspace prefix\n"
+            "  -c connections   parallel import connections (4)\n"
+            "  -t ttl           import TTL in seconds of the records without one\n"
+            "  -f json|ndjson   import format (by the file extension .ndjson/.jsonl, else json)\n"
+            "  -H host -P port -A auth   migration target server (the source server)\n"
+            "  -N base -X prefix         migration target base (0) and prefix (the source prefix)\n"
+            "  -r rate          migrated keys per second (unlimited)\n"
+            "  -d               delete the migrated source keys (kept)\n"
+            "import reads the file or stdin: a JSON object of keys, a JSON array of records or NDJSON records\n"
+            "export writes NDJSON records to the file or stdout\n",
+            VERSION, name);
+}
+
+int main(int argc, char *argv[])
+{
+    tool_options options = {"localhost", 6379, NULL, 0, "", 4, 0, -1, {NULL, 6379, NULL, 0, 0}, 0, NULL, 0, 0};
+
+    if (argc < 2 || (strcmp(argv[1], "import") && strcmp(argv[1], "export") && strcmp(argv[1], "migrate")))
+    {
+        tool_usage(argv[0]);
+        return 2;
+    }
+    int import = !strcmp(argv[1], "import");
+
+    int opt = 0;
+    optind = 2;
+    while (-1 != (opt = getopt(argc, argv, "h:p:a:n:x:c:t:f:H:P:A:N:X:r:d")))
+    {
+        switch (opt)
+        {
+        case 'h':
+            options.host = optarg;
+            break;
+        case 'p':
+            options.port = atoi(optarg);
+            break;
+        case 'a':
+            options.auth = optarg;
+            break;
+        case 'n':
+            options.base = atoi(optarg);
+            break;
+        case 'x':
+            options.prefix = optarg;
+            break;
+        case 'c':
+            options.connections = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 't':
+            options.ttl = atoll(optarg);
+            break;
+        case 'f':
+            options.ndjson = !strcmp(optarg, "ndjson");
+            break;
+        case 'H':
+            options.target.host = optarg;
+            break;
+        case 'P':
+            options.target.port = atoi(optarg);
+            break;
+        case 'A':
+            options.target.auth = optarg;
+            break;
+        case 'N':
+            options.target_base = atoi(optarg);
+            break;
+        case 'X':
+            options.target_prefix = optarg;
+            break;
+        case 'r':
+            options.rate = atoll(optarg);
+            break;
+        case 'd':
+            options.move = 1;
+            break;
+        default:
+            tool_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!strcmp(argv[1], "migrate"))
+    {
+        return tool_migrate(&options);
+    }
+
+    char *file = optind < argc ? argv[optind] : NULL;
+    if (options.ndjson < 0)
+    {
+        char *extension = file ? strrchr(file, '.') : NULL;
+        options.ndjson = extension && (!strcmp(extension, ".ndjson") || !strcmp(extension, ".jsonl"));
+    }
+    FILE *stream = file ? fopen(file, import ? "r" : "w") : (import ? stdin : stdout);
+    if (!stream)
+    {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return 1;
+    }
+
+    int ret = import ? tool_import(&options, stream) : tool_export(&options, stream);
+
+    if (file)
+    {
+        fclose(stream);
+    }
+    return ret;
+}